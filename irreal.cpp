@@ -0,0 +1,3699 @@
+#include <cstdlib>
+#include <cstring>
+#include <sys/types.h>
+#include <map>
+#include <deque>
+#include <iterator>
+#include <algorithm>
+#include <charconv>
+#include <exception>
+#include <stdexcept>
+#include <sched.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "irreal.h"
+
+const std::string WHITESPACE( " \t\n\r" );
+const std::string NUMBERS( "1234567890" );
+
+#define SYMBOL_CURRENT	0
+#define SYMBOL_PARAMS	1
+#define SYMBOL_OUT		2
+
+#define FRAME_CODE		0
+#define FRAME_LOOP_TEST	1
+#define FRAME_LOOP_BODY	2
+#define FRAME_JOB		3
+
+#define CMD_BEGIN 	(0x80 | 1 )
+#define CMD_END 	(0x80 | 2 )
+#define CMD_PUSH	(0x80 | 3 )
+#define CMD_POP		(0x80 | 4 )
+#define CMD_DEF		(0x80 | 5 )
+#define CMD_MERGE	(0x80 | 6 )
+#define CMD_CALL	(0x80 | 7 )
+#define CMD_JOIN	(0x80 | 8 )
+#define CMD_ADD		(0x80 | 9 )
+#define CMD_PRINT	(0x80 | 10 )
+#define CMD_SYNC	(0x80 | 11 )
+#define CMD_DUP		(0x80 | 12 )
+#define CMD_WHILE	(0x80 | 13 )
+#define CMD_IF		(0x80 | 14 )
+#define CMD_SUB		(0x80 | 15 )
+#define CMD_MUL		(0x80 | 16 )
+#define CMD_DIV		(0x80 | 17 )
+#define CMD_MOD		(0x80 | 18 )
+#define CMD_LENGTH	(0x80 | 19 )
+#define CMD_MACRO	(0x80 | 20 )
+#define CMD_SWAP	(0x80 | 21 )
+#define CMD_ROTR	(0x80 | 22 )
+#define CMD_ROTL	(0x80 | 23 )
+#define CMD_CALL_SYNC	(0x80 | 24 )
+#define CMD_PMAP	(0x80 | 25 )
+#define CMD_PREDUCE	(0x80 | 26 )
+#define CMD_SPAWN	(0x80 | 27 )
+
+
+
+std::string debug_cmd_names[] = { "", "BEGIN", "END", "PUSH", "POP", "DEF", 
+								"MERGE", "CALL", "JOIN", "ADD",  "PRINT",
+								"SYNC", "DUP", "WHILE", "IF", "SUB", "MUL", "DIV", "MOD", "LENGTH", "MACRO", "SWAP", "ROTR", "ROTL",
+								"CALL!", "PMAP", "PREDUCE", "SPAWN" };
+
+std::string integer_to_string( long int integer ){
+	char buffer[64];
+	sprintf( buffer, "%li", integer );
+	return std::string( buffer );
+	}
+
+long int string_to_integer( std::string str ){
+	return atol( str.c_str() );
+	}
+
+void test_for_error( bool is_null, std::string error ){
+	if( is_null ){
+		fprintf( stderr, "ERROR: %s\n", error.c_str() );
+		exit( 1 );
+		}
+	}
+
+// Errors of a running script only end the context that hit them, the
+// worker catches them in IrrealVM :: run
+struct IrrealScriptError {
+	std::string message;
+	};
+
+void test_for_script_error( bool failed, const char *error ){
+	if( failed ){
+		throw IrrealScriptError{ error };
+		}
+	}
+
+
+// Reserved stack names get fixed ids
+std::map< std::string, uint64_t, std::less<> > global_symbol_ids = { 
+	{ "CURRENT", SYMBOL_CURRENT }, { "PARAMS", SYMBOL_PARAMS }, { "OUT", SYMBOL_OUT } };
+std::vector< std::string > global_symbol_names = { "CURRENT", "PARAMS", "OUT" };
+
+pthread_mutex_t global_symbols_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Numeric value of every symbol, as atol() reads its name, so '-1' works
+// in arithmetic without going back to the text. Chunks are never moved,
+// a value is written once when interned and read without the lock.
+#define SYMBOL_CHUNK_SIZE	4096
+#define SYMBOL_CHUNKS		65536
+
+int64_t *global_symbol_values[ SYMBOL_CHUNKS ];
+
+void set_symbol_integer( uint64_t symbol, std::string_view name ){
+	size_t chunk = symbol / SYMBOL_CHUNK_SIZE;
+	
+	test_for_error( chunk >= SYMBOL_CHUNKS, "Too many symbols!" );
+	
+	if( global_symbol_values[ chunk ] == NULL ){
+		int64_t *values = (int64_t *)calloc( SYMBOL_CHUNK_SIZE, sizeof( int64_t ) );
+		test_for_error( values == NULL, "Out of memory!" );
+		__atomic_store_n( &global_symbol_values[ chunk ], values, __ATOMIC_RELEASE );
+		}
+	global_symbol_values[ chunk ][ symbol % SYMBOL_CHUNK_SIZE ] = atol( std::string( name ).c_str() );
+	}
+
+// Reserved symbols are not numbers and have no chunk until one is added
+int64_t symbol_integer( uint64_t symbol ){
+	int64_t *values = __atomic_load_n( &global_symbol_values[ symbol / SYMBOL_CHUNK_SIZE ], __ATOMIC_ACQUIRE );
+	return values != NULL ? values[ symbol % SYMBOL_CHUNK_SIZE ] : 0;
+	}
+
+// Maps a symbol name to a small integer id, creating a new id when needed
+uint64_t intern_symbol( std::string_view name ){
+	uint64_t out;
+	
+	pthread_mutex_lock( &global_symbols_lock );
+	
+	std::map< std::string, uint64_t, std::less<> >::iterator it = global_symbol_ids.find( name );
+	if( it != global_symbol_ids.end() ){
+		out = it->second;
+		}
+	else{
+		out = global_symbol_names.size();
+		set_symbol_integer( out, name );
+		global_symbol_names.push_back( std::string( name ) );
+		global_symbol_ids.emplace( name, out );
+		}
+	
+	pthread_mutex_unlock( &global_symbols_lock );
+	return out;
+	}
+
+size_t symbol_count(){
+	size_t out;
+	
+	pthread_mutex_lock( &global_symbols_lock );
+	out = global_symbol_names.size();
+	pthread_mutex_unlock( &global_symbols_lock );
+	
+	return out;
+	}
+
+std::string symbol_name( uint64_t symbol ){
+	std::string out;
+	
+	pthread_mutex_lock( &global_symbols_lock );
+	out = global_symbol_names[ symbol ];
+	pthread_mutex_unlock( &global_symbols_lock );
+	
+	return out;
+	}
+
+
+// Per-thread slab allocator for the small objects created at a high rate.
+// Freed objects go to the free list of the thread that frees them and are
+// reused from there, so memory stays flat once the working set is reached.
+// A thread freeing more than it allocates hands whole slabs' worth of 
+// objects over to a shared list the other threads refill from, an exiting
+// thread hands over all of its objects.
+template< class T > class IrrealPool {
+	public:
+		static void* allocate();
+		static void release( void * );
+		static void drain();
+		
+	private:
+		struct Node { Node *next; };
+		struct Chunk { Node *first; size_t count; };
+		static __thread Node *free_list;
+		static __thread size_t free_count;
+		
+		static std::vector< Chunk > shared_chunks;
+		static pthread_mutex_t shared_lock;
+	};
+
+#define POOL_SLAB_SIZE 64
+
+template< class T > __thread typename IrrealPool< T >::Node *IrrealPool< T >::free_list = NULL;
+template< class T > __thread size_t IrrealPool< T >::free_count = 0;
+template< class T > std::vector< typename IrrealPool< T >::Chunk > IrrealPool< T >::shared_chunks;
+template< class T > pthread_mutex_t IrrealPool< T >::shared_lock = PTHREAD_MUTEX_INITIALIZER;
+
+template< class T > void* IrrealPool< T > :: allocate(){
+	if( free_list == NULL ){
+		pthread_mutex_lock( &shared_lock );
+		if( shared_chunks.size() > 0 ){
+			free_list = shared_chunks.back().first;
+			free_count = shared_chunks.back().count;
+			shared_chunks.pop_back();
+			}
+		pthread_mutex_unlock( &shared_lock );
+		}
+	
+	if( free_list == NULL ){
+		size_t size = sizeof( T ) > sizeof( Node ) ? sizeof( T ) : sizeof( Node );
+		size = ( size + 15 ) & ~( (size_t)15 );
+		
+		char *slab = (char *)malloc( size * POOL_SLAB_SIZE );
+		test_for_error( slab == NULL, "Out of memory!" );
+		
+		for( size_t i = 0 ; i < POOL_SLAB_SIZE ; ++i ){
+			Node *node = (Node *)( slab + i * size );
+			node->next = free_list;
+			free_list = node;
+			}
+		free_count = POOL_SLAB_SIZE;
+		}
+	
+	Node *out = free_list;
+	free_list = out->next;
+	--free_count;
+	return out;
+	}
+
+template< class T > void IrrealPool< T > :: release( void *ptr ){
+	Node *node = (Node *)ptr;
+	node->next = free_list;
+	free_list = node;
+	++free_count;
+	
+	if( free_count >= 2 * POOL_SLAB_SIZE ){
+		Node *chunk = free_list;
+		Node *last = chunk;
+		
+		for( size_t i = 1 ; i < POOL_SLAB_SIZE ; ++i ){
+			last = last->next;
+			}
+		free_list = last->next;
+		free_count -= POOL_SLAB_SIZE;
+		last->next = NULL;
+		
+		pthread_mutex_lock( &shared_lock );
+		shared_chunks.push_back( Chunk{ chunk, POOL_SLAB_SIZE } );
+		pthread_mutex_unlock( &shared_lock );
+		}
+	}
+
+template< class T > void IrrealPool< T > :: drain(){
+	if( free_list == NULL ){ return; }
+	
+	pthread_mutex_lock( &shared_lock );
+	shared_chunks.push_back( Chunk{ free_list, free_count } );
+	pthread_mutex_unlock( &shared_lock );
+	
+	free_list = NULL;
+	free_count = 0;
+	}
+
+
+std::string stack_name( IrrealStack * );
+bool future_ready( IrrealFuture * );
+IrrealStack* future_result( IrrealFuture * );
+const std::string* future_error( IrrealFuture * );
+
+IrrealValue :: IrrealValue(){ type = 0; state = STATE_OK; integer = 0; }
+
+// Stacks and sentinels hold references, they can't be made from raw data
+void check_raw_type( uint8_t type ){
+	if( type == TYPE_STACK || type == TYPE_SENTINEL ){
+		throw std::invalid_argument( "IrrealValue: Stack or sentinel from raw data!" );
+		}
+	}
+
+IrrealValue :: IrrealValue( uint8_t aType, uint8_t aState, std::string aValue ){
+	check_raw_type( aType );
+	type = aType;
+	state = aState;
+	integer = 0;
+	setValue( aValue );
+	}
+
+IrrealValue :: IrrealValue( uint8_t aType, uint8_t aState, int64_t aInteger ){
+	check_raw_type( aType );
+	type = aType;
+	state = aState;
+	integer = aInteger;
+	}
+
+IrrealValue :: IrrealValue( uint8_t aType, uint8_t aState, IrrealStack *aStack ){
+	type = aType;
+	state = aState;
+	stack = aStack;
+	retain();
+	}
+
+IrrealValue :: IrrealValue( IrrealFuture *aFuture ){
+	type = TYPE_SENTINEL;
+	state = STATE_NOT_YET;
+	future = aFuture;
+	retain();
+	}
+
+IrrealValue :: IrrealValue( const IrrealValue &other ){
+	type = other.type;
+	state = other.state;
+	integer = other.integer;
+	retain();
+	}
+
+IrrealValue :: IrrealValue( IrrealValue &&other ){
+	type = other.type;
+	state = other.state;
+	integer = other.integer;
+	other.type = 0;
+	}
+
+IrrealValue :: ~IrrealValue(){ release(); }
+
+IrrealValue& IrrealValue :: operator=( const IrrealValue &other ){
+	if( this != &other ){
+		release();
+		type = other.type;
+		state = other.state;
+		integer = other.integer;
+		retain();
+		}
+	return *this;
+	}
+
+IrrealValue& IrrealValue :: operator=( IrrealValue &&other ){
+	if( this != &other ){
+		release();
+		type = other.type;
+		state = other.state;
+		integer = other.integer;
+		other.type = 0;
+		}
+	return *this;
+	}
+
+// Sentinel of a finished call behaves like the stack holding the result
+uint8_t IrrealValue :: getType(){
+	if( type == TYPE_SENTINEL && future_ready( future ) ){
+		return TYPE_STACK;
+		}
+	return type;
+	}
+
+uint8_t IrrealValue :: getState(){
+	if( type == TYPE_SENTINEL ){
+		return future_ready( future ) ? STATE_OK : STATE_NOT_YET;
+		}
+	return state;
+	}
+
+// Parses textual representation according to current type
+void IrrealValue :: setValue( std::string aValue ){
+	switch( type ){
+		case TYPE_INTEGER:
+			integer = string_to_integer( aValue );
+		break;
+		case TYPE_SYMBOL:
+		case TYPE_STRING:
+			symbol = intern_symbol( aValue );
+		break;
+		}
+	}
+
+// Textual representation, only needed when printing or resolving names
+std::string IrrealValue :: getValue(){
+	switch( type ){
+		case TYPE_INTEGER:
+			return integer_to_string( integer );
+		case TYPE_SYMBOL:
+		case TYPE_STRING:
+			return symbol_name( symbol );
+		case TYPE_STACK:
+			return stack_name( stack );
+		case TYPE_SENTINEL:
+			return stack_name( future_result( future ) );
+		}
+	return std::string( "" );
+	}
+
+int64_t IrrealValue :: getInteger(){
+	switch( type ){
+		case TYPE_INTEGER:
+			return integer;
+		case TYPE_SYMBOL:
+		case TYPE_STRING:
+			// Symbols such as '-5' have always evaluated as numbers
+			return symbol_integer( symbol );
+		}
+	return 0;
+	}
+
+uint64_t IrrealValue :: getSymbol(){ return symbol; }
+IrrealStack* IrrealValue :: getStack(){
+	if( type == TYPE_SENTINEL ){
+		return future_result( future );
+		}
+	return stack;
+	}
+
+IrrealFuture* IrrealValue :: getFuture(){ return type == TYPE_SENTINEL ? future : NULL; }
+
+// Code is shared by frames and by the blocks spawned from it, so it is
+// reference counted and freed by whoever releases it last
+IrrealCode :: IrrealCode(){ refs = 0; }
+
+void IrrealCode :: append( const IrrealValue &value ){
+	instructions.push_back( value );
+	}
+
+// Appends an instruction with its block end already resolved
+void IrrealCode :: append( const IrrealValue &value, size_t block_end ){
+	instructions.push_back( value );
+	block_ends.push_back( block_end );
+	}
+
+// Returns an error message if the blocks do not match
+const char* IrrealCode :: resolveBlocks(){
+	std::vector< size_t > open_blocks;
+	
+	block_ends.assign( instructions.size(), 0 );
+	
+	for( size_t i = 0 ; i < instructions.size() ; ++i ){
+		switch( instructions[i].getType() ){
+			case CMD_BEGIN:
+				open_blocks.push_back( i );
+			break;
+			case CMD_END:
+				if( open_blocks.size() < 1 ){
+					return "Unmatched '}'!";
+					}
+				block_ends[ open_blocks.back() ] = i;
+				open_blocks.pop_back();
+			break;
+			}
+		}
+	
+	if( open_blocks.size() > 0 ){
+		return "Unmatched '{'!";
+		}
+	return NULL;
+	}
+
+// Gives the parser, the '.irrc' loader and stacks access to the private
+// builder methods of IrrealCode
+struct IrrealCodeBuilder {
+	static void append( IrrealCode *code, const IrrealValue &value ){ code->append( value ); }
+	static void append( IrrealCode *code, const IrrealValue &value, size_t block_end ){ code->append( value, block_end ); }
+	static void appendStack( IrrealCode *code, IrrealStack *source, bool top_first ){ code->appendStack( source, top_first ); }
+	static const char* resolveBlocks( IrrealCode *code ){ return code->resolveBlocks(); }
+	};
+
+size_t IrrealCode :: size(){ return instructions.size(); }
+IrrealValue* IrrealCode :: at( size_t i ){ return &instructions[i]; }
+size_t IrrealCode :: blockEnd( size_t i ){ return block_ends[i]; }
+
+void IrrealCode :: retain(){ __sync_add_and_fetch( &refs, 1 ); }
+
+void IrrealCode :: release(){
+	if( __sync_sub_and_fetch( &refs, 1 ) == 0 ){
+		delete this;
+		}
+	}
+
+// Values shared by several stacks. A segment is never changed while it is
+// shared, stacks viewing it take their own copy before changing it.
+struct IrrealSegment {
+	std::vector< IrrealValue > values;
+	uint64_t refs;
+	};
+
+void release_segment( IrrealSegment *segment ){
+	if( __sync_sub_and_fetch( &segment->refs, 1 ) == 0 ){
+		delete segment;
+		}
+	}
+
+// Appends values lo..hi of a segment, walking them backwards if 'backwards'
+void append_segment( std::vector< IrrealValue > &target, IrrealSegment *segment, size_t lo, size_t hi, bool backwards ){
+	std::vector< IrrealValue > &values = segment->values;
+	
+	if( backwards ){
+		target.insert( target.end(), values.rend() - hi, values.rend() - lo );
+		}
+	else{
+		target.insert( target.end(), values.begin() + lo, values.begin() + hi );
+		}
+	}
+
+// Stacks are reference counted by the contexts defining them and by the
+// values referring to them, the last release returns them to the pool
+class IrrealStack {
+	public:
+		IrrealStack();
+		IrrealStack( IrrealCode *, size_t, size_t );
+		~IrrealStack();
+		void push( const IrrealValue & );
+		bool pop( IrrealValue & );
+		bool peek( IrrealValue & );
+		size_t size();
+		void merge( IrrealStack *, bool );
+		void nondestructive_merge( IrrealStack *, bool );
+		
+		void copyTo( std::vector< IrrealValue > &, bool );
+		
+		void _debug_print();
+		uint64_t _debug_get_counter();
+		
+		uint64_t get_id();
+		
+		void rotate_stack( bool );
+		
+		bool getBlock( IrrealCode **, size_t *, size_t * );
+		IrrealCode* getCode( bool );
+		void clear();
+		
+		void retain();
+		void release();
+		void setOwned( bool );
+		
+		static void* operator new( size_t );
+		static void operator delete( void * );
+		
+	private:
+		void materialize();
+		void compact();
+		bool isEmpty();
+		IrrealSegment* share( size_t *, size_t *, bool * );
+		void lock();
+		void unlock();
+		
+		// Slots below 'stack_head' are left over from rotating
+		std::vector< IrrealValue > stack;
+		size_t stack_head;
+		IrrealCode *block;
+		size_t block_begin, block_end;
+		
+		// View of shared values, bottom of the stack is at 'segment_lo'
+		// unless the view is reversed
+		IrrealSegment *segment;
+		size_t segment_lo, segment_hi;
+		bool segment_reversed;
+		pthread_mutex_t stack_lock;
+		bool owned;
+		uint64_t pop_counter;
+		uint64_t stack_id;
+		uint64_t refs;
+		
+		// Contents linked as code, valid while the version is unchanged
+		uint64_t version, code_version;
+		IrrealCode *code_cache;
+		bool code_top_first;
+		
+		static uint64_t next_stack_id;
+	
+	};
+
+uint64_t IrrealStack :: next_stack_id = 0;
+
+IrrealStack :: IrrealStack(){
+	pthread_mutex_init( &stack_lock, NULL );
+	owned = false;
+	stack_head = 0;
+	pop_counter = 0;
+	refs = 0;
+	stack_id = __sync_fetch_and_add( &next_stack_id, 1 );
+	
+	block = NULL;
+	block_begin = block_end = 0;
+	segment = NULL;
+	
+	version = code_version = 0;
+	code_cache = NULL;
+	code_top_first = false;
+	}
+
+// Stack holding a block of code. The instructions are only copied out
+// if the stack is used as data.
+IrrealStack :: IrrealStack( IrrealCode *code, size_t begin, size_t end ){
+	pthread_mutex_init( &stack_lock, NULL );
+	owned = false;
+	stack_head = 0;
+	pop_counter = 0;
+	refs = 0;
+	stack_id = __sync_fetch_and_add( &next_stack_id, 1 );
+	
+	block = code;
+	block_begin = begin;
+	block_end = end;
+	block->retain();
+	segment = NULL;
+	
+	version = code_version = 0;
+	code_cache = NULL;
+	code_top_first = false;
+	}
+
+IrrealStack :: ~IrrealStack(){
+	if( block != NULL ){
+		block->release();
+		}
+	if( code_cache != NULL ){
+		code_cache->release();
+		}
+	if( segment != NULL ){
+		release_segment( segment );
+		}
+	pthread_mutex_destroy( &stack_lock );
+	}
+
+void* IrrealStack :: operator new( size_t size ){ return IrrealPool< IrrealStack >::allocate(); }
+void IrrealStack :: operator delete( void *ptr ){ IrrealPool< IrrealStack >::release( ptr ); }
+
+void IrrealStack :: retain(){ __sync_add_and_fetch( &refs, 1 ); }
+
+void IrrealStack :: release(){
+	if( __sync_sub_and_fetch( &refs, 1 ) == 0 ){
+		delete this;
+		}
+	}
+
+// Stacks private to a context (CURRENT, PARAMS and OUT) are only touched
+// by the thread running it, so they are used without locking. They are
+// handed over to another thread only through the run queues.
+void IrrealStack :: setOwned( bool aOwned ){ owned = aOwned; }
+
+void IrrealStack :: lock(){
+	if( !owned ){ pthread_mutex_lock( &stack_lock ); }
+	}
+
+void IrrealStack :: unlock(){
+	if( !owned ){ pthread_mutex_unlock( &stack_lock ); }
+	}
+
+std::string stack_name( IrrealStack *stack ){
+	return std::string( "_anon_" ) + integer_to_string( stack->get_id() );
+	}
+
+// Gives the stack its own copy of the contents before it is changed, 
+// a shared segment no longer used by anyone else is taken over in place.
+// Called with the stack locked.
+void IrrealStack :: materialize(){
+	if( block != NULL ){
+		stack.reserve( block_end - block_begin );
+		for( size_t i = block_begin ; i < block_end ; ++i ){
+			stack.push_back( *block->at( i ) );
+			}
+		block->release();
+		block = NULL;
+		}
+	
+	if( segment == NULL ){ return; }
+	
+	if( __atomic_load_n( &segment->refs, __ATOMIC_ACQUIRE ) == 1 ){
+		std::vector< IrrealValue > &values = segment->values;
+		
+		values.erase( values.begin() + segment_hi, values.end() );
+		values.erase( values.begin(), values.begin() + segment_lo );
+		if( segment_reversed ){
+			std::reverse( values.begin(), values.end() );
+			}
+		stack.swap( values );
+		}
+	else{
+		append_segment( stack, segment, segment_lo, segment_hi, segment_reversed );
+		}
+	
+	release_segment( segment );
+	segment = NULL;
+	}
+
+// Drops the slots left below the bottom by rotation
+void IrrealStack :: compact(){
+	if( stack_head > 0 ){
+		stack.erase( stack.begin(), stack.begin() + stack_head );
+		stack_head = 0;
+		}
+	}
+
+bool IrrealStack :: isEmpty(){
+	return block == NULL && segment == NULL && stack.size() <= stack_head;
+	}
+
+// Turns the contents into a segment and returns another reference to it.
+// Called with the stack locked.
+IrrealSegment* IrrealStack :: share( size_t *lo, size_t *hi, bool *reversed ){
+	if( segment == NULL ){
+		materialize();
+		compact();
+		
+		segment = new IrrealSegment();
+		segment->refs = 1;
+		segment->values.swap( stack );
+		segment_lo = 0;
+		segment_hi = segment->values.size();
+		segment_reversed = false;
+		}
+	
+	__sync_add_and_fetch( &segment->refs, 1 );
+	*lo = segment_lo;
+	*hi = segment_hi;
+	*reversed = segment_reversed;
+	return segment;
+	}
+
+// If the stack is still an untouched block, returns its code range
+bool IrrealStack :: getBlock( IrrealCode **code, size_t *begin, size_t *end ){
+	lock();
+	
+	if( block == NULL ){
+		unlock();
+		return false;
+		}
+	
+	block->retain();
+	*code = block;
+	*begin = block_begin;
+	*end = block_end;
+	
+	unlock();
+	return true;
+	}
+
+// Code for the contents of the stack. Functions are linked once when they
+// are first called and shared by every later call until the stack changes.
+IrrealCode* IrrealStack :: getCode( bool top_first ){
+	IrrealCode *out, *stale;
+	uint64_t seen;
+	
+	lock();
+	if( code_cache != NULL && code_version == version && code_top_first == top_first ){
+		out = code_cache;
+		out->retain();
+		unlock();
+		return out;
+		}
+	seen = version;
+	unlock();
+	
+	out = new IrrealCode();
+	IrrealCodeBuilder::appendStack( out, this, top_first );
+	
+	const char *error = IrrealCodeBuilder::resolveBlocks( out );
+	if( error != NULL ){
+		delete out;
+		test_for_script_error( true, error );
+		}
+	out->retain();
+	
+	// Tagged with the version seen before copying, a change made in 
+	// between only causes the code to be linked again
+	out->retain();
+	lock();
+	stale = code_cache;
+	code_cache = out;
+	code_version = seen;
+	code_top_first = top_first;
+	unlock();
+	
+	if( stale != NULL ){
+		stale->release();
+		}
+	return out;
+	}
+
+uint64_t IrrealStack :: get_id(){ return stack_id; }
+
+void IrrealStack :: _debug_print(){
+	std::vector< IrrealValue > values;
+	
+	copyTo( values, false );
+	for( size_t i = 0 ; i < values.size() ; ++i ){
+		if( values[i].getType() & TYPE_OPERATOR ){
+			printf( "%s ", debug_cmd_names[ values[i].getType() & (~0x80 ) ].c_str() );
+			}
+		else{
+			printf( "%s ", values[i].getValue().c_str() );
+			}
+		}
+	printf( "\n" );
+	}
+
+uint64_t IrrealStack :: _debug_get_counter(){ return pop_counter; }
+
+void IrrealStack :: clear(){
+	lock();
+	
+	if( block != NULL ){
+		block->release();
+		block = NULL;
+		}
+	if( segment != NULL ){
+		release_segment( segment );
+		segment = NULL;
+		}
+	stack.clear();
+	stack_head = 0;
+	++version;
+	
+	unlock();
+	}
+
+void IrrealStack :: push( const IrrealValue &value ){
+	
+	lock();
+	
+	materialize();
+	stack.push_back( value );
+	++version;
+	
+	unlock();
+	}
+
+// Moves the top value out, returns false if the stack is empty. Shared
+// values are popped by narrowing the view.
+bool IrrealStack :: pop( IrrealValue &out ){
+
+	lock();
+	
+	++pop_counter;
+	
+	if( segment != NULL ){
+		IrrealValue tmp( segment_reversed ? segment->values[ segment_lo++ ] : segment->values[ --segment_hi ] );
+		if( segment_lo == segment_hi ){
+			release_segment( segment );
+			segment = NULL;
+			}
+		++version;
+		
+		unlock();
+		
+		out = std::move( tmp );
+		return true;
+		}
+	
+	materialize();
+	
+	if( stack.size() <= stack_head ){
+		
+		unlock();
+		return false; 
+		}
+	IrrealValue tmp( std::move( stack.back() ) );
+	stack.pop_back();
+	if( stack.size() == stack_head ){
+		stack.clear();
+		stack_head = 0;
+		}
+	++version;
+	
+	unlock();
+	
+	out = std::move( tmp );
+	return true;
+	}
+
+bool IrrealStack :: peek( IrrealValue &out ){
+
+	lock();
+	
+	if( segment != NULL ){
+		IrrealValue tmp( segment_reversed ? segment->values[ segment_lo ] : segment->values[ segment_hi - 1 ] );
+		unlock();
+		
+		out = std::move( tmp );
+		return true;
+		}
+	
+	materialize();	
+	if( stack.size() <= stack_head ){
+		unlock();
+		return false; 
+		}
+	IrrealValue tmp( stack.back() );
+	unlock();
+	
+	out = std::move( tmp );
+	return true;
+	}
+
+size_t IrrealStack :: size(){
+	size_t out;
+	
+	lock();
+	if( block != NULL ){
+		out = block_end - block_begin;
+		}
+	else if( segment != NULL ){
+		out = segment_hi - segment_lo;
+		}
+	else{
+		out = stack.size() - stack_head;
+		}
+	unlock();
+	
+	return out; 
+	}
+
+// Appends a copy of the contents, either from top to bottom or from 
+// bottom to top
+void IrrealStack :: copyTo( std::vector< IrrealValue > &target, bool top_first ){
+	lock();
+	
+	if( segment != NULL ){
+		append_segment( target, segment, segment_lo, segment_hi, segment_reversed != top_first );
+		unlock();
+		return;
+		}
+	
+	materialize();
+	if( top_first ){
+		target.insert( target.end(), stack.rbegin(), stack.rend() - stack_head );
+		}
+	else{
+		target.insert( target.end(), stack.begin() + stack_head, stack.end() );
+		}
+	
+	unlock();
+	}
+
+// Copies the other stack, without 'reverse' its top ends up at the bottom.
+// An empty stack just shares the values until one of the two changes.
+void IrrealStack :: nondestructive_merge( IrrealStack *other, bool reverse ){
+	IrrealSegment *shared;
+	size_t lo, hi;
+	bool reversed;
+	
+	other->lock();
+	shared = other->share( &lo, &hi, &reversed );
+	other->unlock();
+	
+	lock();
+	
+	if( isEmpty() ){
+		segment = shared;
+		segment_lo = lo;
+		segment_hi = hi;
+		segment_reversed = reverse ? reversed : !reversed;
+		++version;
+		
+		unlock();
+		return;
+		}
+	
+	materialize();	
+	append_segment( stack, shared, lo, hi, reverse ? reversed : !reversed );
+	++version;
+	
+	unlock();
+	
+	release_segment( shared );
+	}
+
+// Takes everything from the other stack, the values end up in the order
+// they are popped from it. An empty stack takes the storage over as is.
+void IrrealStack :: merge( IrrealStack *other, bool reverse ){
+	IrrealSegment *taken;
+	size_t lo, hi;
+	bool reversed;
+	
+	other->lock();
+	if( other->segment == NULL ){
+		other->materialize();
+		other->compact();
+		if( other->stack.size() < 1 ){
+			other->unlock();
+			return;
+			}
+		
+		taken = new IrrealSegment();
+		taken->refs = 1;
+		taken->values.swap( other->stack );
+		lo = 0;
+		hi = taken->values.size();
+		reversed = false;
+		}
+	else{
+		taken = other->segment;
+		lo = other->segment_lo;
+		hi = other->segment_hi;
+		reversed = other->segment_reversed;
+		other->segment = NULL;
+		}
+	++other->version;
+	other->unlock();
+	
+	lock();
+	
+	if( isEmpty() ){
+		segment = taken;
+		segment_lo = lo;
+		segment_hi = hi;
+		segment_reversed = !reversed;
+		++version;
+		
+		unlock();
+		return;
+		}
+	
+	materialize();	
+	append_segment( stack, taken, lo, hi, !reversed );
+	++version;
+	
+	unlock();
+	
+	release_segment( taken );
+	}
+
+// Moves the bottom value to the top (left) or the top value to the bottom
+// (right). Rotating right fills free slots below the bottom, which are 
+// made in bulk, and rotating left leaves them behind until they take up 
+// most of the storage, so both are O(1) amortized.
+void IrrealStack :: rotate_stack( bool left ){
+	lock();
+	
+	materialize();
+	
+	size_t n = stack.size() - stack_head;
+	if( n < 2 ){
+		unlock();
+		return;
+		}
+	
+	if( left ){
+		stack.push_back( std::move( stack[ stack_head ] ) );
+		++stack_head;
+		if( stack_head * 4 > stack.size() * 3 ){
+			compact();
+			}
+		}
+	else{
+		if( stack_head == 0 ){
+			stack.insert( stack.begin(), n, IrrealValue() );
+			stack_head = n;
+			}
+		--stack_head;
+		stack[ stack_head ] = std::move( stack.back() );
+		stack.pop_back();
+		}
+	++version;
+	
+	unlock();
+	}
+
+// Appends contents of a stack, either from top to bottom (the order
+// defined functions are stored in) or from bottom to top (blocks)
+void IrrealCode :: appendStack( IrrealStack *source, bool top_first ){
+	IrrealCode *block;
+	size_t begin, end;
+	
+	if( !top_first && source->getBlock( &block, &begin, &end ) ){
+		for( size_t i = begin ; i < end ; ++i ){
+			instructions.push_back( *block->at( i ) );
+			}
+		block->release();
+		return;
+		}
+	
+	source->copyTo( instructions, top_first );
+	}
+
+// Stack of a name, with the scope epoch it was resolved in when cached
+struct IrrealSymbolSlot {
+	uint64_t symbol;
+	IrrealStack *stack;
+	uint64_t epoch;
+	};
+
+// Open addressing table from symbol id to stack. It grows with the names
+// a context uses, not with the symbols of the whole program.
+class IrrealSymbolTable {
+	public:
+		IrrealSymbolTable();
+		
+		IrrealSymbolSlot* find( uint64_t );
+		IrrealSymbolSlot* insert( uint64_t );
+		void clear();
+		
+		size_t capacity();
+		IrrealSymbolSlot* at( size_t );
+	
+	private:
+		void grow();
+		
+		std::vector< IrrealSymbolSlot > slots;
+		size_t count;
+	};
+
+#define SYMBOL_TABLE_MIN 8
+#define SYMBOL_TABLE_KEEP 64
+
+IrrealSymbolTable :: IrrealSymbolTable(){
+	count = 0;
+	}
+
+size_t IrrealSymbolTable :: capacity(){ return slots.size(); }
+IrrealSymbolSlot* IrrealSymbolTable :: at( size_t i ){ return &slots[i]; }
+
+// Symbol ids are dense, so the low bits spread them well enough
+IrrealSymbolSlot* IrrealSymbolTable :: find( uint64_t symbol ){
+	if( count == 0 ){ return NULL; }
+	
+	size_t mask = slots.size() - 1;
+	for( size_t i = symbol & mask ; slots[i].stack != NULL ; i = ( i + 1 ) & mask ){
+		if( slots[i].symbol == symbol ){
+			return &slots[i];
+			}
+		}
+	
+	return NULL;
+	}
+
+// Slot for the symbol, a new one has no stack yet
+IrrealSymbolSlot* IrrealSymbolTable :: insert( uint64_t symbol ){
+	IrrealSymbolSlot *slot = find( symbol );
+	if( slot != NULL ){ return slot; }
+	
+	if( ( count + 1 ) * 4 > slots.size() * 3 ){
+		grow();
+		}
+	
+	size_t mask = slots.size() - 1;
+	size_t i = symbol & mask;
+	while( slots[i].stack != NULL ){
+		i = ( i + 1 ) & mask;
+		}
+	
+	++count;
+	slots[i].symbol = symbol;
+	slots[i].epoch = 0;
+	return &slots[i];
+	}
+
+// Slots are only claimed by storing a stack, so the caller must set one
+void IrrealSymbolTable :: grow(){
+	std::vector< IrrealSymbolSlot > old;
+	old.swap( slots );
+	
+	IrrealSymbolSlot empty = { 0, NULL, 0 };
+	slots.resize( old.size() > 0 ? old.size() * 2 : SYMBOL_TABLE_MIN, empty );
+	
+	size_t mask = slots.size() - 1;
+	for( size_t j = 0 ; j < old.size() ; ++j ){
+		if( old[j].stack == NULL ){ continue; }
+		size_t i = old[j].symbol & mask;
+		while( slots[i].stack != NULL ){
+			i = ( i + 1 ) & mask;
+			}
+		slots[i] = old[j];
+		}
+	}
+
+// Large tables are dropped, so a pooled context doesn't keep paying for
+// the one call that defined many names
+void IrrealSymbolTable :: clear(){
+	if( slots.size() > SYMBOL_TABLE_KEEP ){
+		std::vector< IrrealSymbolSlot >().swap( slots );
+		}
+	else{
+		for( size_t i = 0 ; i < slots.size() ; ++i ){
+			slots[i].stack = NULL;
+			}
+		}
+	count = 0;
+	}
+
+// Bumped whenever a definition might shadow a name cached by a callee
+uint64_t global_scope_epoch = 1;
+
+// Range of linked code
+struct IrrealRange {
+	IrrealCode *code;
+	size_t begin, end;
+	};
+
+struct IrrealJob;
+void release_job( IrrealJob * );
+
+// Position in a range of code. Loop frames alternate between running
+// their test and their body until the test evaluates to zero. Job frames
+// run their body once for every value next..last of a data parallel job.
+struct IrrealFrame {
+	IrrealCode *code;
+	size_t ip, end;
+	uint8_t kind;
+	IrrealRange test, body;
+	
+	IrrealJob *job;
+	size_t chunk, next, last;
+	bool collect;
+	IrrealValue acc;
+	};
+
+
+class IrrealContext {
+	public:
+		IrrealContext();
+		~IrrealContext();
+		static IrrealContext* create();
+		static void drainPool();
+		IrrealStack* getCurrentStack();
+		IrrealStack* getParamsStack();
+		IrrealStack* getOutStack();
+		
+		void pushFrame( IrrealCode *, size_t, size_t );
+		void pushStackFrame( IrrealStack *, bool );
+		void pushLoopFrame( IrrealStack *, IrrealStack * );
+		void pushJobFrame( IrrealRange, IrrealJob *, size_t, size_t, size_t );
+		IrrealFrame* topFrame();
+		void popFrame();
+		void spawnNewStack( uint64_t );
+
+		IrrealStack* getStack( uint64_t );
+		IrrealStack* getStack( IrrealValue * );
+		IrrealStack* findStack( uint64_t, uint64_t );
+		void setParent( IrrealContext * );
+		
+		uint8_t getState();
+		void setState( uint8_t );
+		
+		void setFuture( IrrealFuture * );
+		IrrealFuture* getFuture();
+		IrrealContext* getParent();
+		
+		void setNextWaiter( IrrealContext * );
+		IrrealContext* getNextWaiter();
+		
+		void addChild();
+		bool childDone();
+		bool waitChildren();
+		
+		uint64_t get_id();
+	
+		void lock_context();
+		void unlock_context();
+		
+		void retain();
+		void release();
+	
+		void mark();
+		uint64_t read_marks();
+	
+	private:
+		IrrealContext *parent;
+		std::vector< IrrealFrame > frames;
+		
+		// Stacks defined in this context besides CURRENT, PARAMS and OUT.
+		// Only the owner writes the table, others read it under the lock.
+		IrrealSymbolTable stacks;
+		pthread_rwlock_t stacks_lock;
+		IrrealStack *current, *params, *out;
+		
+		// Names resolved from the enclosing contexts, callees read it
+		// under the stacks lock as well
+		IrrealSymbolTable lookup_cache;
+		bool has_children;
+		uint8_t state;
+		IrrealFuture *future;
+		
+		// Calls made by this context that have not finished yet
+		uint64_t pending_children;
+		uint8_t joining;
+		
+		pthread_mutex_t context_lock;
+		
+		// Held by the context itself until it finishes and by every
+		// callee, as they resolve names through it
+		uint64_t refs;
+		
+		uint64_t context_id, marks;
+		
+		void reset();
+		
+		// Next context parked on the same future
+		IrrealContext *next_waiter;
+		
+		// Finished contexts are kept with their stacks for reuse
+		IrrealContext *next_free;
+		static __thread IrrealContext *free_contexts;
+		static __thread size_t num_free_contexts;
+		
+		static uint64_t next_context_id;
+	};
+
+#define CONTEXT_POOL_SIZE 256
+
+uint64_t IrrealContext :: next_context_id = 0;
+__thread IrrealContext *IrrealContext :: free_contexts = NULL;
+__thread size_t IrrealContext :: num_free_contexts = 0;
+
+IrrealContext :: IrrealContext(){
+	
+	context_id = __sync_fetch_and_add( &next_context_id, 1 );
+	
+	pthread_rwlock_init( &stacks_lock, NULL );
+	
+	current = new IrrealStack();
+	params = new IrrealStack();
+	out = new IrrealStack();
+	current->retain();
+	params->retain();
+	out->retain();
+	current->setOwned( true );
+	params->setOwned( true );
+	out->setOwned( true );
+	
+	parent = NULL;
+	has_children = false;
+	
+	state = STATE_OK;
+	
+	
+	future = NULL;
+	pending_children = 0;
+	joining = 0;
+	
+	//context_lock = PTHREAD_MUTEX_INITIALIZER;
+	
+	pthread_mutex_init( &context_lock, NULL );
+	
+	marks = 0;
+	refs = 1;
+	next_waiter = NULL;
+	next_free = NULL;
+	
+	}
+
+// Takes a context from the pool of this worker, a recycled context only
+// gets a new id
+IrrealContext* IrrealContext :: create(){
+	IrrealContext *out = free_contexts;
+	
+	if( out == NULL ){
+		return new IrrealContext();
+		}
+	
+	free_contexts = out->next_free;
+	--num_free_contexts;
+	
+	out->next_free = NULL;
+	out->refs = 1;
+	out->context_id = __sync_fetch_and_add( &next_context_id, 1 );
+	
+	return out;
+	}
+
+void IrrealContext :: retain(){ __sync_add_and_fetch( &refs, 1 ); }
+
+void IrrealContext :: release(){
+	if( __sync_sub_and_fetch( &refs, 1 ) == 0 ){
+		reset();
+		
+		if( num_free_contexts < CONTEXT_POOL_SIZE ){
+			next_free = free_contexts;
+			free_contexts = this;
+			++num_free_contexts;
+			}
+		else{
+			delete this;
+			}
+		}
+	}
+
+uint8_t IrrealContext :: getState(){ return state; }
+void IrrealContext :: setState( uint8_t new_state ){ state = new_state; }
+
+void IrrealContext :: lock_context(){ pthread_mutex_lock( &context_lock ); }
+void IrrealContext :: unlock_context(){ pthread_mutex_unlock( &context_lock ); }
+
+void IrrealContext :: mark(){ ++marks; }
+uint64_t IrrealContext :: read_marks(){ return marks; }
+
+IrrealStack* IrrealContext :: getCurrentStack(){ return current; }
+IrrealStack* IrrealContext :: getParamsStack(){ return params; }
+IrrealStack* IrrealContext :: getOutStack(){ return out; }
+
+void IrrealContext :: pushFrame( IrrealCode *code, size_t begin, size_t end ){
+	IrrealFrame frame = IrrealFrame();
+	code->retain();
+	frame.code = code;
+	frame.ip = begin;
+	frame.end = end;
+	frame.kind = FRAME_CODE;
+	frames.push_back( frame );
+	}
+
+// Code range for contents of a stack, untouched blocks are used in place
+IrrealRange stack_range( IrrealStack *stack, bool top_first ){
+	IrrealRange out;
+	
+	if( !top_first && stack->getBlock( &out.code, &out.begin, &out.end ) ){
+		return out;
+		}
+	
+	out.code = stack->getCode( top_first );
+	out.begin = 0;
+	out.end = out.code->size();
+	
+	return out;
+	}
+
+void IrrealContext :: pushStackFrame( IrrealStack *stack, bool top_first ){
+	IrrealRange range = stack_range( stack, top_first );
+	pushFrame( range.code, range.begin, range.end );
+	range.code->release();
+	}
+
+// Starts with the test, frame keeps the references to both ranges
+void IrrealContext :: pushLoopFrame( IrrealStack *test, IrrealStack *body ){
+	IrrealFrame frame = IrrealFrame();
+	frame.test = stack_range( test, false );
+	frame.body = stack_range( body, false );
+	frame.code = frame.test.code;
+	frame.ip = frame.test.begin;
+	frame.end = frame.test.end;
+	frame.kind = FRAME_LOOP_TEST;
+	frames.push_back( frame );
+	}
+
+// Frame gets the reference to the range, the job is retained by the caller.
+// It starts at its end, so the first value is loaded before running.
+void IrrealContext :: pushJobFrame( IrrealRange range, IrrealJob *job, size_t chunk, size_t first, size_t last ){
+	IrrealFrame frame = IrrealFrame();
+	frame.body = range;
+	frame.code = range.code;
+	frame.ip = range.end;
+	frame.end = range.end;
+	frame.kind = FRAME_JOB;
+	frame.job = job;
+	frame.chunk = chunk;
+	frame.next = first;
+	frame.last = last;
+	frame.collect = false;
+	frames.push_back( frame );
+	}
+
+IrrealFrame* IrrealContext :: topFrame(){
+	if( frames.size() < 1 ){ return NULL; }
+	return &frames.back();
+	}
+
+void IrrealContext :: popFrame(){
+	if( frames.back().kind == FRAME_CODE ){
+		frames.back().code->release();
+		}
+	else if( frames.back().kind == FRAME_JOB ){
+		frames.back().body.code->release();
+		release_job( frames.back().job );
+		}
+	else{
+		frames.back().test.code->release();
+		frames.back().body.code->release();
+		}
+	frames.pop_back();
+	}
+
+// Redefining a stack empties it in place, so references to it stay valid
+void IrrealContext :: spawnNewStack( uint64_t symbol ){
+	
+	if( symbol <= SYMBOL_OUT ){
+		getStack( symbol )->clear();
+		return;
+		}
+	
+	IrrealSymbolSlot *slot = stacks.find( symbol );
+	if( slot != NULL ){
+		slot->stack->clear();
+		return;
+		}
+	
+	IrrealStack *stack = new IrrealStack();
+	stack->retain();
+	
+	pthread_rwlock_wrlock( &stacks_lock );
+	stacks.insert( symbol )->stack = stack;
+	pthread_rwlock_unlock( &stacks_lock );
+	
+	// Running callees may have cached the name from further up the chain.
+	// Bumped after the insert, so whoever sees the new epoch finds it.
+	if( has_children ){
+		__atomic_add_fetch( &global_scope_epoch, 1, __ATOMIC_RELEASE );
+		}
+	}
+
+// Lookup from a callee. A name this context already resolved in the same
+// epoch is taken from its cache, so callees don't walk past it.
+IrrealStack* IrrealContext :: findStack( uint64_t symbol, uint64_t epoch ){
+	IrrealStack *out = NULL;
+	
+	if( symbol <= SYMBOL_OUT ){
+		return getStack( symbol );
+		}
+	
+	pthread_rwlock_rdlock( &stacks_lock );
+	IrrealSymbolSlot *slot = stacks.find( symbol );
+	if( slot == NULL ){
+		slot = lookup_cache.find( symbol );
+		if( slot != NULL && slot->epoch != epoch ){
+			slot = NULL;
+			}
+		}
+	if( slot != NULL ){
+		out = slot->stack;
+		}
+	pthread_rwlock_unlock( &stacks_lock );
+	
+	return out;
+	}
+
+// Own stacks first, then the cache and the chain of callers. A recursive
+// call finds the name in its caller's cache, one level up.
+IrrealStack* IrrealContext :: getStack( uint64_t symbol ){
+	
+	switch( symbol ){
+		case SYMBOL_CURRENT: return current;
+		case SYMBOL_PARAMS: return params;
+		case SYMBOL_OUT: return out;
+		}
+	
+	IrrealSymbolSlot *slot = stacks.find( symbol );
+	if( slot != NULL ){
+		return slot->stack;
+		}
+	
+	uint64_t epoch = __atomic_load_n( &global_scope_epoch, __ATOMIC_ACQUIRE );
+	
+	slot = lookup_cache.find( symbol );
+	if( slot != NULL && slot->epoch == epoch ){
+		return slot->stack;
+		}
+	
+	for( IrrealContext *scope = parent ; scope != NULL ; scope = scope->parent ){
+		IrrealStack *out = scope->findStack( symbol, epoch );
+		if( out != NULL ){
+			pthread_rwlock_wrlock( &stacks_lock );
+			slot = lookup_cache.insert( symbol );
+			slot->stack = out;
+			slot->epoch = epoch;
+			pthread_rwlock_unlock( &stacks_lock );
+			return out;
+			}
+		}
+	
+	return NULL;
+	}
+
+// Anonymous stacks are referenced directly, symbols are looked up by name
+IrrealStack* IrrealContext :: getStack( IrrealValue *value ){
+	switch( value->getType() ){
+		case TYPE_STACK:
+		case TYPE_SENTINEL:
+			// Using the result of a failed call fails the caller as well
+			if( value->getFuture() != NULL ){
+				const std::string *error = future_error( value->getFuture() );
+				test_for_script_error( error != NULL, error != NULL ? error->c_str() : NULL );
+				}
+			return value->getStack();
+		case TYPE_SYMBOL:
+			return getStack( value->getSymbol() );
+		}
+	return getStack( intern_symbol( value->getValue() ) );
+	}
+
+// Names not found in this context are resolved through the caller
+void IrrealContext :: setParent( IrrealContext *ctx ){
+	parent = ctx;
+	parent->retain();
+	ctx->has_children = true;
+	}
+
+
+IrrealFuture* IrrealContext :: getFuture(){ return future; }
+IrrealContext* IrrealContext :: getParent(){ return parent; }
+
+void IrrealContext :: setNextWaiter( IrrealContext *ctx ){ next_waiter = ctx; }
+IrrealContext* IrrealContext :: getNextWaiter(){ return next_waiter; }
+
+void IrrealContext :: addChild(){
+	__sync_add_and_fetch( &pending_children, 1 );
+	}
+
+// Returns true if the context was parked on 'join' and has to be scheduled
+bool IrrealContext :: childDone(){
+	if( __sync_sub_and_fetch( &pending_children, 1 ) == 0 ){
+		return __sync_bool_compare_and_swap( &joining, 1, 0 );
+		}
+	return false;
+	}
+
+// Returns true if the context has to wait, the last child wakes it up
+bool IrrealContext :: waitChildren(){
+	__atomic_store_n( &joining, 1, __ATOMIC_SEQ_CST );
+	if( __atomic_load_n( &pending_children, __ATOMIC_SEQ_CST ) == 0 ){
+		return !__sync_bool_compare_and_swap( &joining, 1, 0 );
+		}
+	return true;
+	}
+
+// Result of a call. Contexts syncing on it park themselves in the list of
+// waiters and the callee schedules them again when the result has been
+// delivered.
+// The future is referenced by the sentinels and by the callee until it
+// has delivered the result.
+class IrrealFuture {
+	public:
+		IrrealFuture();
+		~IrrealFuture();
+		IrrealStack* getResult();
+		bool isReady();
+		bool wait( IrrealContext * );
+		void block();
+		IrrealContext* complete();
+		void fail( const std::string & );
+		const std::string* getError();
+		
+		void retain();
+		void release();
+		
+		static void* operator new( size_t );
+		static void operator delete( void * );
+		
+	private:
+		IrrealStack *result;
+		uint8_t ready, blocking;
+		IrrealContext *waiters;
+		std::string *error;
+		uint64_t refs;
+	};
+
+IrrealFuture :: IrrealFuture(){
+	result = new IrrealStack();
+	result->retain();
+	ready = 0;
+	blocking = 0;
+	waiters = NULL;
+	error = NULL;
+	refs = 0;
+	}
+
+IrrealFuture :: ~IrrealFuture(){
+	result->release();
+	delete error;
+	}
+
+void* IrrealFuture :: operator new( size_t size ){ return IrrealPool< IrrealFuture >::allocate(); }
+void IrrealFuture :: operator delete( void *ptr ){ IrrealPool< IrrealFuture >::release( ptr ); }
+
+void IrrealFuture :: retain(){ __sync_add_and_fetch( &refs, 1 ); }
+
+void IrrealFuture :: release(){
+	if( __sync_sub_and_fetch( &refs, 1 ) == 0 ){
+		delete this;
+		}
+	}
+
+IrrealStack* IrrealFuture :: getResult(){ return result; }
+
+bool IrrealFuture :: isReady(){ return __atomic_load_n( &ready, __ATOMIC_ACQUIRE ); }
+
+// Marks the list of waiters once the future has completed
+#define FUTURE_COMPLETED ( (IrrealContext *)1 )
+
+// Returns true if the context has to wait for the result. Waiters are
+// pushed to the list until complete() takes it over.
+bool IrrealFuture :: wait( IrrealContext *ctx ){
+	IrrealContext *head = __atomic_load_n( &waiters, __ATOMIC_SEQ_CST );
+	do{
+		if( head == FUTURE_COMPLETED ){
+			return false;
+			}
+		ctx->setNextWaiter( head );
+		} while( !__atomic_compare_exchange_n( &waiters, &head, ctx, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST ) );
+	return true;
+	}
+
+// Threads other than the workers wait for futures on a shared condition
+pthread_mutex_t global_future_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t global_future_cond = PTHREAD_COND_INITIALIZER;
+
+// Blocks the calling thread until the result is ready
+void IrrealFuture :: block(){
+	pthread_mutex_lock( &global_future_lock );
+	__atomic_store_n( &blocking, 1, __ATOMIC_SEQ_CST );
+	while( !__atomic_load_n( &ready, __ATOMIC_SEQ_CST ) ){
+		pthread_cond_wait( &global_future_cond, &global_future_lock );
+		}
+	pthread_mutex_unlock( &global_future_lock );
+	}
+
+// Marks the result ready and returns the contexts to be woken up, linked
+// through their next waiter
+IrrealContext* IrrealFuture :: complete(){
+	__atomic_store_n( &ready, 1, __ATOMIC_SEQ_CST );
+	if( __atomic_load_n( &blocking, __ATOMIC_SEQ_CST ) ){
+		pthread_mutex_lock( &global_future_lock );
+		pthread_cond_broadcast( &global_future_cond );
+		pthread_mutex_unlock( &global_future_lock );
+		}
+	return __atomic_exchange_n( &waiters, FUTURE_COMPLETED, __ATOMIC_SEQ_CST );
+	}
+
+// Records why the call failed, only the first error is kept. It is set
+// before the future completes, so it is seen by whoever gets the result.
+void IrrealFuture :: fail( const std::string &message ){
+	std::string *copy = new std::string( message );
+	if( !__sync_bool_compare_and_swap( &error, NULL, copy ) ){
+		delete copy;
+		}
+	}
+
+const std::string* IrrealFuture :: getError(){ return __atomic_load_n( &error, __ATOMIC_ACQUIRE ); }
+
+bool future_ready( IrrealFuture *future ){ return future->isReady(); }
+IrrealStack* future_result( IrrealFuture *future ){ return future->getResult(); }
+const std::string* future_error( IrrealFuture *future ){ return future->getError(); }
+
+void IrrealValue :: retain(){
+	switch( type ){
+		case TYPE_STACK:
+			stack->retain();
+		break;
+		case TYPE_SENTINEL:
+			future->retain();
+		break;
+		}
+	}
+
+void IrrealValue :: release(){
+	switch( type ){
+		case TYPE_STACK:
+			stack->release();
+		break;
+		case TYPE_SENTINEL:
+			future->release();
+		break;
+		}
+	}
+
+// Drops the stacks defined in the context, the ones still referenced by
+// values (results, parameters passed on) stay alive until released.
+// CURRENT, PARAMS and OUT are only emptied and kept for the next call.
+void IrrealContext :: reset(){
+	
+	while( frames.size() > 0 ){
+		popFrame();
+		}
+	
+	for( size_t i = 0 ; i < stacks.capacity() ; ++i ){
+		if( stacks.at( i )->stack != NULL ){
+			stacks.at( i )->stack->release();
+			}
+		}
+	stacks.clear();
+	
+	current->clear();
+	params->clear();
+	out->clear();
+	lookup_cache.clear();
+	
+	if( future != NULL ){
+		future->release();
+		future = NULL;
+		}
+	
+	IrrealContext *caller = parent;
+	
+	parent = NULL;
+	has_children = false;
+	state = STATE_OK;
+	pending_children = 0;
+	joining = 0;
+	marks = 0;
+	
+	if( caller != NULL ){
+		caller->release();
+		}
+	}
+
+IrrealContext :: ~IrrealContext(){
+	current->release();
+	params->release();
+	out->release();
+	
+	pthread_rwlock_destroy( &stacks_lock );
+	pthread_mutex_destroy( &context_lock );
+	}
+
+// Callee keeps the future alive until the result is delivered
+void IrrealContext :: setFuture( IrrealFuture *aFuture ){
+	future = aFuture;
+	future->retain();
+	}
+
+uint64_t IrrealContext :: get_id(){ return context_id;  }
+
+// Contexts pooled by an exiting thread would never be reused
+void IrrealContext :: drainPool(){
+	while( free_contexts != NULL ){
+		IrrealContext *context = free_contexts;
+		free_contexts = context->next_free;
+		delete context;
+		}
+	num_free_contexts = 0;
+	}
+
+// Deleting the contexts frees their stacks, so they go first
+void release_thread_pools(){
+	IrrealContext::drainPool();
+	IrrealPool< IrrealStack >::drain();
+	IrrealPool< IrrealFuture >::drain();
+	}
+
+// Run queue of a single worker. The owner pushes new calls to the front
+// and takes work from the front, idle workers steal from the back.
+class IrrealWorkQueue {
+	public:
+		IrrealWorkQueue();
+		void pushFront( IrrealContext * );
+		void pushFront( const std::vector< IrrealContext* >& );
+		void pushBack( IrrealContext * );
+		IrrealContext* popFront();
+		IrrealContext* popBack();
+		
+	private:
+		std::deque< IrrealContext* > queue;
+		pthread_mutex_t queue_lock;
+	};
+
+IrrealWorkQueue :: IrrealWorkQueue(){
+	pthread_mutex_init( &queue_lock, NULL );
+	}
+
+void IrrealWorkQueue :: pushFront( IrrealContext *ctx ){
+	pthread_mutex_lock( &queue_lock );
+	queue.push_front( ctx );
+	pthread_mutex_unlock( &queue_lock );
+	}
+
+// Keeps the order of 'batch', its first context is taken first
+void IrrealWorkQueue :: pushFront( const std::vector< IrrealContext* > &batch ){
+	pthread_mutex_lock( &queue_lock );
+	queue.insert( queue.begin(), batch.begin(), batch.end() );
+	pthread_mutex_unlock( &queue_lock );
+	}
+
+void IrrealWorkQueue :: pushBack( IrrealContext *ctx ){
+	pthread_mutex_lock( &queue_lock );
+	queue.push_back( ctx );
+	pthread_mutex_unlock( &queue_lock );
+	}
+
+IrrealContext* IrrealWorkQueue :: popFront(){
+	IrrealContext *out = NULL;
+	
+	pthread_mutex_lock( &queue_lock );
+	if( queue.size() > 0 ){
+		out = queue.front();
+		queue.pop_front();
+		}
+	pthread_mutex_unlock( &queue_lock );
+	
+	return out;
+	}
+
+IrrealContext* IrrealWorkQueue :: popBack(){
+	IrrealContext *out = NULL;
+	
+	pthread_mutex_lock( &queue_lock );
+	if( queue.size() > 0 ){
+		out = queue.back();
+		queue.pop_back();
+		}
+	pthread_mutex_unlock( &queue_lock );
+	
+	return out;
+	}
+
+// New calls run first, waiting contexts go to the back of the queue
+void IrrealVM :: schedule_context( uint64_t thread_id, IrrealContext *ctx, bool first ){
+	if( first ){
+		work_queues[ thread_id ].pushFront( ctx );
+		}
+	else{
+		work_queues[ thread_id ].pushBack( ctx );
+		}
+	
+	__atomic_add_fetch( &work_seq, 1, __ATOMIC_SEQ_CST );
+	if( __atomic_load_n( &idle_workers, __ATOMIC_SEQ_CST ) > 0 ){
+		pthread_mutex_lock( &idle_lock );
+		pthread_cond_signal( &idle_cond );
+		pthread_mutex_unlock( &idle_lock );
+		}
+	}
+
+// Publishes many new calls with a single queue operation and wakes up
+// as many idle workers as there is work for
+void IrrealVM :: schedule_contexts( uint64_t thread_id, const std::vector< IrrealContext* > &batch ){
+	if( batch.size() < 1 ){
+		return;
+		}
+	
+	work_queues[ thread_id ].pushFront( batch );
+	
+	__atomic_add_fetch( &work_seq, 1, __ATOMIC_SEQ_CST );
+	if( __atomic_load_n( &idle_workers, __ATOMIC_SEQ_CST ) > 0 ){
+		pthread_mutex_lock( &idle_lock );
+		if( batch.size() > 1 ){
+			pthread_cond_broadcast( &idle_cond );
+			}
+		else{
+			pthread_cond_signal( &idle_cond );
+			}
+		pthread_mutex_unlock( &idle_lock );
+		}
+	}
+
+// Sleeps unless something was scheduled after 'seq' was read
+void IrrealVM :: wait_for_work( uint64_t seq ){
+	pthread_mutex_lock( &idle_lock );
+	
+	__atomic_add_fetch( &idle_workers, 1, __ATOMIC_SEQ_CST );
+	if( __atomic_load_n( &work_seq, __ATOMIC_SEQ_CST ) == seq && 
+		__atomic_load_n( &running_vms, __ATOMIC_SEQ_CST ) > 0 ){
+		pthread_cond_wait( &idle_cond, &idle_lock );
+		}
+	__atomic_sub_fetch( &idle_workers, 1, __ATOMIC_SEQ_CST );
+	
+	pthread_mutex_unlock( &idle_lock );
+	}
+
+void IrrealVM :: vm_started( uint64_t count ){
+	__atomic_add_fetch( &running_vms, count, __ATOMIC_SEQ_CST );
+	}
+
+// Wakes up every worker for shutdown once the last VM is done
+void IrrealVM :: vm_finished(){
+	if( __atomic_sub_fetch( &running_vms, 1, __ATOMIC_SEQ_CST ) == 0 ){
+		pthread_mutex_lock( &idle_lock );
+		pthread_cond_broadcast( &idle_cond );
+		pthread_mutex_unlock( &idle_lock );
+		}
+	}
+
+// Own queue first, then try to steal from the other workers
+IrrealContext* IrrealVM :: next_context( uint64_t thread_id ){
+	IrrealContext *out = work_queues[ thread_id ].popFront();
+	
+	for( size_t i = 1 ; out == NULL && i < num_threads ; ++i ){
+		out = work_queues[ ( thread_id + i ) % num_threads ].popBack();
+		}
+	
+	return out;
+	}
+
+// Stacks are passed to a call as a copy of their values
+IrrealValue call_param( IrrealContext *ctx, IrrealValue &p ){
+	if( p.getType() == TYPE_SYMBOL || p.getType() == TYPE_STACK ){
+		IrrealStack *pstack = new IrrealStack();
+		IrrealStack *target_stack = ctx->getStack( &p );
+		
+		test_for_script_error( target_stack == NULL, "CALL: Undefined symbol!" );
+		
+		pstack->nondestructive_merge( target_stack, false );
+		return IrrealValue( TYPE_STACK, STATE_OK, pstack );
+		}
+	return p;
+	}
+
+// Sets up a call of 'func_stack' with 'nparams' values taken from the 
+// caller's CURRENT stack. The result is delivered to 'future'.
+IrrealContext* new_call( IrrealContext *ctx, IrrealStack *func_stack, size_t nparams, IrrealFuture *future ){
+	IrrealStack *current = ctx->getCurrentStack();
+	IrrealContext *new_ctx = IrrealContext::create();
+	
+	new_ctx->lock_context();
+	
+	new_ctx->setFuture( future );
+	
+	// A function or parameter that can't be used drops the half built call
+	IrrealStack *params = new_ctx->getParamsStack();
+	try{
+		new_ctx->pushStackFrame( func_stack, true );
+		for( size_t i = 0 ; i < nparams ; ++i ){
+			IrrealValue p;
+			test_for_script_error( !current->pop( p ), "Not enough values to perform 'call'!" );
+			params->push( call_param( ctx, p ) );
+			}
+		}
+	catch( const IrrealScriptError & ){
+		new_ctx->unlock_context();
+		new_ctx->release();
+		throw;
+		}
+	
+	new_ctx->setParent( ctx );
+	ctx->addChild();
+	
+	new_ctx->unlock_context();
+	
+	return new_ctx;
+	}
+
+// Natives are looked up by symbol before the function is resolved in scope
+IrrealNativeEntry* IrrealVM :: find_native( IrrealValue *func ){
+	if( func->getType() != TYPE_SYMBOL || func->getSymbol() >= natives.size() || 
+		natives[ func->getSymbol() ].function == NULL ){
+		return NULL;
+		}
+	return &natives[ func->getSymbol() ];
+	}
+
+// Runs a native right here on the worker. It gets the parameters as the 
+// PARAMS stack of a call would hold them, bottom first, and the values it
+// leaves in 'out' become the result of an already completed call.
+IrrealValue IrrealVM :: call_native( IrrealContext *ctx, IrrealNativeEntry *native, size_t nparams ){
+	IrrealStack *current = ctx->getCurrentStack();
+	std::vector< IrrealValue > params( nparams ), out;
+	
+	for( size_t i = 0 ; i < nparams ; ++i ){
+		IrrealValue p;
+		test_for_script_error( !current->pop( p ), "Not enough values to perform 'call'!" );
+		params[i] = call_param( ctx, p );
+		}
+	
+	// An exception thrown by the native fails the call like a script error
+	try{
+		native->function( params, out, native->data );
+		}
+	catch( const std::exception &error ){
+		throw IrrealScriptError{ error.what() };
+		}
+	
+	// Same order as OUT merged into the result of a call
+	IrrealFuture *future = new IrrealFuture();
+	IrrealStack *result = future->getResult();
+	for( size_t i = out.size() ; i > 0 ; --i ){
+		result->push( out[ i - 1 ] );
+		}
+	future->complete();
+	
+	return IrrealValue( future );
+	}
+
+// Only to be called before any program is started on the VM
+void IrrealVM :: registerNative( std::string_view name, IrrealNative function, void *data ){
+	uint64_t symbol = intern_symbol( name );
+	
+	if( natives.size() <= symbol ){
+		natives.resize( symbol + 1 );
+		}
+	natives[ symbol ].function = function;
+	natives[ symbol ].data = data;
+	}
+
+// Values of a stack or of the result of a call, bottom first
+void stack_values( IrrealValue &value, std::vector< IrrealValue > &out ){
+	out.clear();
+	if( value.getType() == TYPE_STACK ){
+		value.getStack()->copyTo( out, false );
+		}
+	else if( value.getType() == TYPE_SENTINEL ){
+		value.getFuture()->getResult()->copyTo( out, false );
+		}
+	}
+
+IrrealValue new_stack( const std::vector< IrrealValue > &values ){
+	IrrealStack *stack = new IrrealStack();
+	
+	for( size_t i = 0 ; i < values.size() ; ++i ){
+		stack->push( values[i] );
+		}
+	return IrrealValue( TYPE_STACK, STATE_OK, stack );
+	}
+
+// Data parallel 'pmap' or 'preduce' over the values of a stack. The values
+// are split in chunks run by separate contexts, each one writing only its
+// own slot of the results. The last chunk to finish puts the results 
+// together in order and completes the future.
+struct IrrealJob {
+	bool reduce, combining;
+	std::vector< IrrealValue > input;
+	std::vector< std::vector< IrrealValue > > results;
+	IrrealFuture *future;
+	uint64_t remaining, refs;
+	};
+
+#define JOB_MIN_CHUNK			64
+#define JOB_CHUNKS_PER_WORKER	4
+
+void release_job( IrrealJob *job ){
+	if( __sync_sub_and_fetch( &job->refs, 1 ) == 0 ){
+		job->future->release();
+		delete job;
+		}
+	}
+
+// The link is read first, a woken context may park on another future
+void IrrealVM :: wake_waiters( uint64_t thread_id, IrrealContext *waiters ){
+	while( waiters != NULL ){
+		IrrealContext *next = waiters->getNextWaiter();
+		schedule_context( thread_id, waiters, true );
+		waiters = next;
+		}
+	}
+
+void IrrealVM :: finish_job( uint64_t thread_id, IrrealJob *job ){
+	IrrealStack *result = job->future->getResult();
+	
+	for( size_t i = 0 ; i < job->results.size() ; ++i ){
+		for( size_t j = 0 ; j < job->results[i].size() ; ++j ){
+			result->push( job->results[i][j] );
+			}
+		}
+	
+	wake_waiters( thread_id, job->future->complete() );
+	}
+
+// Called at the end of a job frame. Collects what the body left in OUT 
+// for the previous value and loads the next one, returns false once the 
+// chunk is done. With 'preduce' the body gets the accumulated value on 
+// top of PARAMS and the next value below it, the last chunk to finish 
+// also folds the partial results of all chunks in order.
+bool IrrealVM :: step_job( uint64_t thread_id, IrrealContext *ctx, IrrealFrame *frame ){
+	IrrealJob *job = frame->job;
+	IrrealStack *out = ctx->getOutStack();
+	IrrealStack *params = ctx->getParamsStack();
+	
+	if( frame->collect ){
+		if( job->reduce ){
+			test_for_script_error( !out->pop( frame->acc ), "PREDUCE: No value left in OUT!" );
+			}
+		else{
+			out->copyTo( job->results[ frame->chunk ], false );
+			}
+		out->clear();
+		}
+	
+	if( frame->next >= frame->last ){
+		if( job->combining ){
+			job->results.assign( 1, std::vector< IrrealValue >( 1, frame->acc ) );
+			finish_job( thread_id, job );
+			return false;
+			}
+		
+		if( job->reduce ){
+			job->results[ frame->chunk ].assign( 1, frame->acc );
+			}
+		
+		if( __sync_sub_and_fetch( &job->remaining, 1 ) > 0 ){
+			return false;
+			}
+		
+		if( !job->reduce || job->results.size() < 2 || job->future->getError() != NULL ){
+			finish_job( thread_id, job );
+			return false;
+			}
+		
+		job->combining = true;
+		job->input.clear();
+		for( size_t i = 0 ; i < job->results.size() ; ++i ){
+			job->input.push_back( job->results[i][0] );
+			}
+		frame->acc = job->input[0];
+		frame->next = 1;
+		frame->last = job->input.size();
+		}
+	
+	ctx->getCurrentStack()->clear();
+	params->clear();
+	params->push( job->input[ frame->next ] );
+	if( job->reduce ){
+		params->push( frame->acc );
+		}
+	++frame->next;
+	
+	frame->collect = true;
+	frame->ip = frame->body.begin;
+	return true;
+	}
+
+// Splits the input in chunks and schedules a context for each of them,
+// they resolve names through the caller like calls do
+void IrrealVM :: spawn_job( uint64_t thread_id, IrrealContext *ctx, IrrealJob *job, IrrealRange range ){
+	size_t n = job->input.size();
+	size_t chunks = n / JOB_MIN_CHUNK;
+	
+	if( chunks > num_threads * JOB_CHUNKS_PER_WORKER ){
+		chunks = num_threads * JOB_CHUNKS_PER_WORKER;
+		}
+	if( chunks < 1 ){
+		chunks = 1;
+		}
+	
+	job->results.resize( chunks );
+	job->remaining = chunks;
+	job->refs = chunks;
+	
+	std::vector< IrrealContext* > batch;
+	batch.reserve( chunks );
+	
+	for( size_t i = 0 ; i < chunks ; ++i ){
+		size_t first = n * i / chunks;
+		size_t last = n * ( i + 1 ) / chunks;
+		IrrealContext *new_ctx = IrrealContext::create();
+		
+		new_ctx->lock_context();
+		
+		range.code->retain();
+		if( job->reduce ){
+			new_ctx->pushJobFrame( range, job, i, first + 1, last );
+			new_ctx->topFrame()->acc = job->input[ first ];
+			}
+		else{
+			new_ctx->pushJobFrame( range, job, i, first, last );
+			}
+		new_ctx->setParent( ctx );
+		ctx->addChild();
+		
+		new_ctx->unlock_context();
+		
+		batch.push_back( new_ctx );
+		}
+	
+	vm_started( chunks );
+	schedule_contexts( thread_id, batch );
+	}
+
+// Execution trace. Every worker records into its own buffer which is
+// written out in one go when full, so tracing does not serialize workers
+// on stdio. Records can be filtered by opcode and by context id.
+struct IrrealTraceRecord {
+	uint64_t time;
+	uint64_t ctx_id;
+	int64_t payload;
+	uint32_t thread_id;
+	uint8_t type;
+	uint8_t padding[3];
+	};
+
+#define TRACE_BUFFER_SIZE	4096
+#define TRACE_VERSION		1
+
+bool global_trace_enabled = false;
+bool global_trace_binary = false;
+bool global_trace_ops[ 256 ];
+bool global_trace_filter_ops = false;
+std::vector< uint64_t > global_trace_contexts;
+FILE *global_trace_file = NULL;
+pthread_mutex_t global_trace_lock = PTHREAD_MUTEX_INITIALIZER;
+
+class IrrealTraceBuffer {
+	public:
+		IrrealTraceBuffer();
+		void record( uint64_t, uint64_t, IrrealValue * );
+		void flush();
+		
+	private:
+		std::vector< IrrealTraceRecord > records;
+	};
+
+IrrealTraceBuffer :: IrrealTraceBuffer(){
+	records.reserve( TRACE_BUFFER_SIZE );
+	}
+
+void IrrealTraceBuffer :: record( uint64_t thread_id, uint64_t ctx_id, IrrealValue *value ){
+	uint8_t type = value->getType();
+	
+	if( global_trace_filter_ops && !global_trace_ops[ type ] ){ return; }
+	
+	if( global_trace_contexts.size() > 0 && 
+		!std::binary_search( global_trace_contexts.begin(), global_trace_contexts.end(), ctx_id ) ){
+		return;
+		}
+	
+	IrrealTraceRecord r;
+	struct timespec now;
+	
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	
+	memset( &r, 0, sizeof( r ) );
+	r.time = now.tv_sec * 1000000000ULL + now.tv_nsec;
+	r.ctx_id = ctx_id;
+	r.thread_id = thread_id;
+	r.type = type;
+	
+	switch( type ){
+		case TYPE_INTEGER:
+			r.payload = value->getInteger();
+		break;
+		case TYPE_SYMBOL:
+			r.payload = value->getSymbol();
+		break;
+		}
+	
+	records.push_back( r );
+	
+	if( records.size() >= TRACE_BUFFER_SIZE ){
+		flush();
+		}
+	}
+
+void IrrealTraceBuffer :: flush(){
+	
+	if( records.size() < 1 ){ return; }
+	
+	pthread_mutex_lock( &global_trace_lock );
+	
+	if( global_trace_binary ){
+		fwrite( &records[0], sizeof( IrrealTraceRecord ), records.size(), global_trace_file );
+		}
+	else{
+		for( size_t i = 0 ; i < records.size() ; ++i ){
+			IrrealTraceRecord *r = &records[i];
+			
+			fprintf( global_trace_file, "%lu %u %lu ", r->time, r->thread_id, r->ctx_id );
+			
+			if( r->type & TYPE_OPERATOR ){
+				fprintf( global_trace_file, "%s\n", debug_cmd_names[ r->type & (~0x80) ].c_str() );
+				}
+			else if( r->type == TYPE_SYMBOL ){
+				fprintf( global_trace_file, "'%s'\n", symbol_name( r->payload ).c_str() );
+				}
+			else{
+				fprintf( global_trace_file, "%li\n", r->payload );
+				}
+			}
+		}
+	
+	pthread_mutex_unlock( &global_trace_lock );
+	
+	records.clear();
+	}
+
+// Opcode filter is a comma separated list of command names, 'value' 
+// selects the non-operator instructions
+void set_trace_ops( const char *list ){
+	std::string names( list );
+	size_t start = 0;
+	
+	global_trace_filter_ops = true;
+	
+	while( start <= names.size() ){
+		size_t stop = names.find( ',', start );
+		if( stop == std::string::npos ){ stop = names.size(); }
+		
+		std::string name = names.substr( start, stop - start );
+		bool found = false;
+		
+		for( size_t i = 1 ; i < sizeof( debug_cmd_names ) / sizeof( debug_cmd_names[0] ) ; ++i ){
+			if( strcasecmp( name.c_str(), debug_cmd_names[i].c_str() ) == 0 ){
+				global_trace_ops[ 0x80 | i ] = true;
+				found = true;
+				}
+			}
+		if( name == "value" ){
+			for( size_t i = 0 ; i < 0x80 ; ++i ){
+				global_trace_ops[i] = true;
+				}
+			found = true;
+			}
+		
+		test_for_error( !found, std::string( "Unknown opcode in trace filter: " ) + name );
+		
+		start = stop + 1;
+		}
+	}
+
+void set_trace_contexts( const char *list ){
+	const char *p = list;
+	
+	while( *p != '\0' ){
+		char *end;
+		global_trace_contexts.push_back( strtoul( p, &end, 10 ) );
+		test_for_error( end == p, "Invalid context id in trace filter!" );
+		p = ( *end == ',' ) ? end + 1 : end;
+		}
+	
+	std::sort( global_trace_contexts.begin(), global_trace_contexts.end() );
+	}
+
+void set_trace_binary( bool binary ){ global_trace_binary = binary; }
+
+// Each VM created afterwards gets its own trace buffers
+void init_tracing( const char *fn ){
+	
+	global_trace_enabled = true;
+	
+	if( strcmp( fn, "-" ) == 0 ){
+		global_trace_file = stderr;
+		}
+	else{
+		global_trace_file = fopen( fn, global_trace_binary ? "wb" : "w" );
+		test_for_error( global_trace_file == NULL, std::string( "Unable to open trace file: " ) + fn );
+		}
+	
+	if( global_trace_binary ){
+		uint32_t header[2] = { 0x43525254, TRACE_VERSION };	// "TRRC"
+		fwrite( header, sizeof( header ), 1, global_trace_file );
+		}
+	}
+
+void finish_tracing(){
+	if( !global_trace_enabled ){ return; }
+	
+	fflush( global_trace_file );
+	}
+
+// Nesting limit for calls run on the caller's thread
+#define INLINE_CALL_DEPTH 64
+
+
+void IrrealVM :: _debug_running_threads(){
+	printf( "Running threads: " );
+	for( size_t i = 0 ; i < num_threads ; ++i ){
+		
+		if( running_threads[i] ){
+			printf( "%lu ", running_threads_vm[i] );
+			}
+		else{
+			printf( "_ " );
+			}
+		
+		}
+	printf( "\n" );
+	
+	}
+
+// Runs one context until it finishes or has to wait, returns false if
+// there was nothing to run
+bool IrrealVM :: execute( uint64_t thread_id ){
+	
+	IrrealContext *ctx = next_context( thread_id );
+	
+	if( ctx == NULL ){ return false; }
+	
+	run( thread_id, ctx, 0 );
+	return true;
+	}
+
+// Delivers the result of a finished context and lets its caller go on
+void IrrealVM :: finish_context( uint64_t thread_id, IrrealContext *ctx ){
+	IrrealFuture *future = ctx->getFuture();
+	if( future != NULL ){
+		future->getResult()->merge( ctx->getOutStack(), false ); 
+		
+		wake_waiters( thread_id, future->complete() );
+		}
+	
+	if( ctx->getParent() != NULL && ctx->getParent()->childDone() ){
+		schedule_context( thread_id, ctx->getParent(), true );
+		}
+	
+	vm_finished();
+	}
+
+// Ends a context that hit an error with an empty result. The error goes
+// to its future, failing the caller once it uses the result, and to the
+// future of the program. Jobs the context was running are failed too, so
+// their callers aren't left waiting.
+void IrrealVM :: fail_context( uint64_t thread_id, IrrealContext *ctx, const std::string &message ){
+	IrrealContext *root = ctx;
+	while( root->getParent() != NULL ){
+		root = root->getParent();
+		}
+	
+	// A call nobody waited for may fail after the program returned
+	IrrealFuture *program = root->getFuture();
+	if( program != NULL ){
+		program->fail( message );
+		if( program->isReady() ){
+			fprintf( stderr, "ERROR: %s\n", message.c_str() );
+			}
+		}
+	
+	for( IrrealFrame *frame = ctx->topFrame() ; frame != NULL ; frame = ctx->topFrame() ){
+		if( frame->kind == FRAME_JOB ){
+			IrrealJob *job = frame->job;
+			job->future->fail( message );
+			if( job->combining || __sync_sub_and_fetch( &job->remaining, 1 ) == 0 ){
+				finish_job( thread_id, job );
+				}
+			}
+		ctx->popFrame();
+		}
+	
+	if( ctx->getFuture() != NULL ){
+		ctx->getFuture()->fail( message );
+		}
+	ctx->getOutStack()->clear();
+	
+	finish_context( thread_id, ctx );
+	}
+
+// Runs the context until it finishes or has to wait, returns true if it 
+// finished. Calls that are synced right away run nested on this thread,
+// 'depth' is the number of such calls below the worker.
+bool IrrealVM :: run( uint64_t thread_id, IrrealContext *ctx, size_t depth ){
+	try{
+		return interpret( thread_id, ctx, depth );
+		}
+	catch( const IrrealScriptError &error ){
+		// Still locked by the interpreter
+		fail_context( thread_id, ctx, error.message );
+		ctx->unlock_context();
+		ctx->release();
+		return true;
+		}
+	}
+
+bool IrrealVM :: interpret( uint64_t thread_id, IrrealContext *ctx, size_t depth ){
+	
+	uint64_t ctx_id = ctx->get_id();
+	
+	ctx->lock_context();
+	
+	running_threads_vm[ thread_id ] = ctx_id;
+	
+	//printf( "Executing vm #%lu\n", ctx_id );
+	//_debug_running_threads();
+	
+	
+	IrrealStack *current;
+	
+	current = ctx->getCurrentStack();
+	
+	test_for_script_error( current == NULL, "Invalid current stack!" );
+	
+	// Contexts waiting on 'join' or 'sync' are only scheduled again once
+	// the values they wait for are ready
+	ctx->setState( STATE_OK );
+	
+	bool done = false;
+	bool finished = false;
+	
+	long int debug_value;
+	
+	IrrealStack *debug_stack;
+	
+	debug_value = ctx->getParamsStack()->size();
+	debug_stack = ctx->getParamsStack();
+	while( !done ){
+		ctx->mark();
+		//printf( "\n\n" ); 
+		IrrealFrame *frame = ctx->topFrame();
+		IrrealValue *q = NULL;
+		
+		if( frame != NULL && frame->ip >= frame->end ){
+			switch( frame->kind ){
+				case FRAME_LOOP_TEST:
+				{
+					IrrealValue test;
+					test_for_script_error( !current->pop( test ), "Not enough values to perform 'while'!" );
+					
+					if( test.getInteger() ){
+						frame->kind = FRAME_LOOP_BODY;
+						frame->code = frame->body.code;
+						frame->ip = frame->body.begin;
+						frame->end = frame->body.end;
+						continue;
+						}
+				}
+				break;
+				
+				case FRAME_LOOP_BODY:
+					frame->kind = FRAME_LOOP_TEST;
+					frame->code = frame->test.code;
+					frame->ip = frame->test.begin;
+					frame->end = frame->test.end;
+				continue;
+				
+				case FRAME_JOB:
+					if( step_job( thread_id, ctx, frame ) ){
+						continue;
+						}
+				break;
+				}
+			
+			ctx->popFrame();
+			continue;
+			}
+		
+		size_t pc = 0;
+		if( frame != NULL ){
+			pc = frame->ip;
+			q = frame->code->at( pc );
+			++frame->ip;
+			}
+		
+		//printf( "current: " ); current->_debug_print();
+		//printf( "params: " ); ctx->getStack("PARAMS")->_debug_print();
+		//printf( "out: " ); ctx->getStack("OUT")->_debug_print();
+		if( q == NULL ){
+			//printf( "q == NULL\n" );
+			done = true; 
+			finished = true;
+			finish_context( thread_id, ctx );
+			continue; 
+			}
+		if( global_trace_enabled ){
+			trace_buffers[ thread_id ].record( thread_id, ctx_id, q );
+			}
+		if( q->getType() & TYPE_OPERATOR ){
+			//printf( "Executing command: %s \n", debug_cmd_names[ q->getType() & (~0x80) ].c_str() );
+			switch( q->getType() ){
+				
+				case CMD_BEGIN:
+				{
+					size_t block_end = frame->code->blockEnd( pc );
+					IrrealStack *block = new IrrealStack( frame->code, pc + 1, block_end );
+					frame->ip = block_end + 1;
+					
+					current->push( IrrealValue( TYPE_STACK, STATE_OK, block ) );
+				}
+				break;
+				
+				case CMD_PUSH:
+				{
+					IrrealValue target_stack_name;
+					IrrealValue value;
+					IrrealStack *target_stack;
+					
+					test_for_script_error( !current->pop( target_stack_name ), "Not enough values to perform 'push'!" );
+					test_for_script_error( !current->pop( value ), "Not enough values to perform 'push'!" );
+					
+					
+					target_stack = ctx->getStack( &target_stack_name );
+					
+					test_for_script_error( target_stack == NULL, "PUSH: Stack not found!" );
+					
+					target_stack->push( value );
+				}
+				break;
+				
+				case CMD_POP:
+				{	
+					IrrealValue target_stack_name;
+					IrrealStack *target_stack, *testing;
+					IrrealValue value;
+					
+					test_for_script_error( !current->pop( target_stack_name ), "Not enough values to perform 'pop'!" );
+					
+					target_stack = ctx->getStack( &target_stack_name );
+					testing = ctx->getStack( &target_stack_name );
+						
+					test_for_script_error( target_stack == NULL, "POP: Stack not found!" );
+					
+					bool popped = target_stack->pop( value );
+					
+					
+					if( !popped ){
+						fprintf( stderr, "\n\n**** Debug info***\n\n" );
+						fprintf( stderr, "In PARAMS stack there were %li entries in the beginning...\n", debug_value ); 
+						fprintf( stderr, "target_stack_name = '%s' \n", target_stack_name.getValue().c_str() );
+						fprintf( stderr, "Context mark count: %lu \n", ctx->read_marks() );
+						fprintf( stderr, "target_stack pop_counter = %lu \n", target_stack->_debug_get_counter() );
+						fprintf( stderr, "target_stack = %p, target_stack->id = %lu \n", target_stack, target_stack->get_id() );
+						fprintf( stderr, "debug_stack = %p, debug_stack->id = %lu \n", debug_stack, debug_stack->get_id() );
+						fprintf( stderr, "testing: %p, testing->id = %lu\n", testing, testing->get_id() );
+						fprintf( stderr, "debug_stack->size = %lu, target_stack->size = %lu, testing->size = %lu \n", debug_stack->size(), target_stack->size(), testing->size() );
+						popped = testing->pop( value );
+						fprintf( stderr, "testing->pop = %i, value->getValue = %s\n", popped, value.getValue().c_str() ); 
+						fprintf( stderr, "\n" );
+						fflush( stderr );
+						popped = false;
+						}
+					test_for_script_error( !popped, "POP: Target stack empty!" );
+					
+					current->push( value );
+				}
+				break;
+				
+				case CMD_DEF:
+				{	
+					IrrealValue target_name;
+					IrrealValue value;
+					
+					test_for_script_error( !current->pop( target_name ), "Not enough values to perform 'def'!" );
+					test_for_script_error( !current->pop( value ), "No enough values to perform 'def'!" );
+					
+					uint64_t target_symbol = target_name.getSymbol();
+					if( target_name.getType() != TYPE_SYMBOL ){
+						target_symbol = intern_symbol( target_name.getValue() );
+						}
+					
+					ctx->spawnNewStack( target_symbol );
+					
+					switch( value.getType() ){
+						case TYPE_SYMBOL:
+						case TYPE_STACK:
+						{
+							IrrealStack *target_stack = ctx->getStack( target_symbol );
+							IrrealStack *source_stack = ctx->getStack( &value );
+							
+							test_for_script_error( target_stack == NULL, "DEF: Target stack not found!" );
+							test_for_script_error( source_stack == NULL, "DEF: Source stack not found!" );
+							
+							
+							if( source_stack != target_stack ){
+								target_stack->merge( source_stack, true );
+								}
+						}
+						break;
+						default:
+						{
+							IrrealStack *target_stack = ctx->getStack( target_symbol );
+							test_for_script_error( target_stack == NULL, "DEF: Target stack not found!" );
+							target_stack->push( value );
+						}	
+						break;
+						}
+				}	
+				break;
+				
+				case CMD_MERGE:
+				{
+					IrrealValue target_name;
+					IrrealStack *target_stack;
+					
+					test_for_script_error( !current->pop( target_name ), "Not enough values to perform 'merge'!" );
+					
+					target_stack = ctx->getStack( &target_name );
+					
+					test_for_script_error( target_stack == NULL, "MERGE: Stack not found!" );
+					
+					current->merge( target_stack, false );
+				}	
+				break;
+				
+				case CMD_CALL:
+				case CMD_CALL_SYNC:
+				{
+					IrrealValue func, nparams;
+					IrrealFuture *future;
+					
+					test_for_script_error( !current->pop( nparams ), "Not enough values to perform 'call'!" );
+					test_for_script_error( !current->pop( func ), "Not enough values to perform 'call'!" );
+					test_for_script_error( nparams.getInteger() < 0, "CALL: Negative number of parameters!" );
+					
+					IrrealNativeEntry *native = find_native( &func );
+					if( native != NULL ){
+						current->push( call_native( ctx, native, nparams.getInteger() ) );
+						break;
+						}
+					
+					IrrealStack *func_stack = ctx->getStack( &func );
+					
+					test_for_script_error( func_stack == NULL, "CALL: Function not found!" );
+					
+					future = new IrrealFuture();
+					IrrealValue return_value( future );
+					
+					IrrealContext *new_ctx = new_call( ctx, func_stack, nparams.getInteger(), future );
+					
+					// A call the caller waits for anyway runs right here, if the
+					// callee has to wait itself it continues as a separate VM
+					bool sync = q->getType() == CMD_CALL_SYNC;
+					bool nested = sync || ( frame->ip < frame->end && frame->code->at( frame->ip )->getType() == CMD_SYNC );
+					
+					vm_started( 1 );
+					if( nested && depth < INLINE_CALL_DEPTH ){
+						run( thread_id, new_ctx, depth + 1 );
+						running_threads_vm[ thread_id ] = ctx_id;
+						}
+					else{
+						schedule_context( thread_id, new_ctx, true );
+						}
+					
+					current->push( return_value );
+					//printf( "current->peek() = '%s' \n", current->peek()->getValue().c_str() );
+					
+					if( sync && !future->isReady() && future->wait( ctx ) ){
+						ctx->setState( STATE_SYNCING );
+						done = true;
+						}
+
+				}
+				break;
+				
+				// 'count' calls of the same function, each taking 'nparams' 
+				// values, published to the scheduler all at once. The 
+				// sentinel of the topmost parameter set ends up on top.
+				case CMD_SPAWN:
+				{
+					IrrealValue func, nparams, count;
+					
+					test_for_script_error( !current->pop( count ), "Not enough values to perform 'spawn'!" );
+					test_for_script_error( !current->pop( nparams ), "Not enough values to perform 'spawn'!" );
+					test_for_script_error( !current->pop( func ), "Not enough values to perform 'spawn'!" );
+					
+					IrrealNativeEntry *native = find_native( &func );
+					IrrealStack *func_stack = native != NULL ? NULL : ctx->getStack( &func );
+					
+					test_for_script_error( native == NULL && func_stack == NULL, "SPAWN: Function not found!" );
+					test_for_script_error( count.getInteger() < 0, "SPAWN: Negative count!" );
+					test_for_script_error( nparams.getInteger() < 0, "SPAWN: Negative number of parameters!" );
+					
+					size_t N = count.getInteger();
+					std::vector< IrrealContext* > batch;
+					std::vector< IrrealValue > return_values;
+					
+					batch.reserve( N );
+					return_values.reserve( N );
+					try{
+						for( size_t i = 0 ; i < N ; ++i ){
+							if( native != NULL ){
+								return_values.push_back( call_native( ctx, native, nparams.getInteger() ) );
+								continue;
+								}
+							IrrealFuture *future = new IrrealFuture();
+							return_values.push_back( IrrealValue( future ) );
+							batch.push_back( new_call( ctx, func_stack, nparams.getInteger(), future ) );
+							}
+						}
+					catch( const IrrealScriptError & ){
+						// Calls set up before the error already count as children
+						vm_started( batch.size() );
+						schedule_contexts( thread_id, batch );
+						throw;
+						}
+					
+					vm_started( batch.size() );
+					schedule_contexts( thread_id, batch );
+					
+					for( size_t i = N ; i > 0 ; --i ){
+						current->push( return_values[ i - 1 ] );
+						}
+				}
+				break;
+				
+				case CMD_PMAP:
+				case CMD_PREDUCE:
+				{
+					IrrealValue func, source;
+					
+					test_for_script_error( !current->pop( func ), "Not enough values to perform 'pmap' or 'preduce'!" );
+					test_for_script_error( !current->pop( source ), "Not enough values to perform 'pmap' or 'preduce'!" );
+					
+					IrrealStack *func_stack = ctx->getStack( &func );
+					IrrealStack *source_stack = ctx->getStack( &source );
+					
+					test_for_script_error( func_stack == NULL, "PMAP/PREDUCE: Function not found!" );
+					test_for_script_error( source_stack == NULL, "PMAP/PREDUCE: Source stack not found!" );
+					
+					IrrealFuture *future = new IrrealFuture();
+					IrrealValue return_value( future );
+					
+					IrrealJob *job = new IrrealJob();
+					job->reduce = q->getType() == CMD_PREDUCE;
+					job->combining = false;
+					job->future = future;
+					future->retain();
+					source_stack->copyTo( job->input, false );
+					
+					if( job->input.size() < 1 ){
+						job->refs = 1;
+						finish_job( thread_id, job );
+						release_job( job );
+						}
+					else{
+						IrrealRange range = stack_range( func_stack, true );
+						spawn_job( thread_id, ctx, job, range );
+						range.code->release();
+						}
+					
+					current->push( return_value );
+				}
+				break;
+				
+				case CMD_JOIN:
+					if( ctx->waitChildren() ){
+						ctx->setState( STATE_JOINING );
+						done = true;
+						}
+				break;
+				
+				case CMD_ADD:
+				{
+					IrrealValue first, second;
+					test_for_script_error( !current->pop( first ), "Not enough values to perform 'add'!" );
+					test_for_script_error( !current->pop( second ), "Not enough values to perform 'add'!" );
+					
+					current->push( IrrealValue( TYPE_INTEGER, STATE_OK, first.getInteger() + second.getInteger() ) );
+				}
+				break;
+				
+				case CMD_PRINT:
+				{
+					IrrealValue value;
+					test_for_script_error( !current->pop( value ), "Not enough values to perform 'print'!" );
+					fprintf( print_file, "print: type = %i, state = %i, value = '%s' \n", value.getType(), value.getState(), value.getValue().c_str() );
+					
+				}
+				break;
+				
+				case CMD_SYNC:
+				{
+					IrrealValue value;
+					
+					test_for_script_error( !current->peek( value ), "Not enough values to perform 'sync'!" );
+					
+					if( value.getState() == STATE_NOT_YET && value.getFuture()->wait( ctx ) ){
+						ctx->setState( STATE_SYNCING );
+						done = true;
+						}
+				}
+				break;
+				
+				case CMD_DUP:
+				{
+					IrrealValue value;
+					test_for_script_error( !current->peek( value ), "Not enough values to perform 'dup'!" );
+				
+					current->push( value );
+				}
+				break;
+
+				case CMD_WHILE:
+				{
+					IrrealValue test, body;
+					
+					test_for_script_error( !current->pop( test ), "Not enough values to perform 'while'!" );
+					test_for_script_error( !current->pop( body ), "Not enough values to perform 'while'!" );
+					
+					
+					IrrealStack *test_stack = ctx->getStack( &test );
+					IrrealStack *body_stack = ctx->getStack( &body );
+					
+					test_for_script_error( test_stack == NULL, "Invalid test stack for 'while'!" );
+					test_for_script_error( body_stack == NULL, "Invalid body stack for 'while'!" );
+					
+					ctx->pushLoopFrame( test_stack, body_stack );
+				}
+				break;
+				
+				case CMD_IF:
+				{
+					IrrealValue test, block_true, block_false;
+						
+					test_for_script_error( !current->pop( block_false ), "Not enough values to perform 'if'!" );
+					test_for_script_error( !current->pop( block_true ), "Not enough values to perform 'if'!" );
+					test_for_script_error( !current->pop( test ), "Not enough values to perform 'if'!" );
+					
+					
+					IrrealStack *stack_true, *stack_false;
+					
+					stack_true = ctx->getStack( &block_true );
+					stack_false = ctx->getStack( &block_false );
+					
+					test_for_script_error( stack_true == NULL, "IF: Stack (true) not found!" );
+					test_for_script_error( stack_false == NULL, "IF: Stack (false) not found!" );
+					
+					
+					//printf( "if: stack_true: " ); stack_true->_debug_print();
+					//printf( "if: stack_false: " ); stack_false->_debug_print();
+					
+					//if( test == NULL ){ printf( "if: test: null!\n" ); } 
+					//printf( "if: test value: %li \n", string_to_integer( test->getValue() ) );
+					
+					if( test.getInteger() ){
+						ctx->pushStackFrame( stack_true, false );
+						}
+					else{
+						ctx->pushStackFrame( stack_false, false );
+						}
+					
+				}
+				break;
+				
+				case CMD_SUB:
+				{
+					IrrealValue first, second;
+					test_for_script_error( !current->pop( second ), "Not enough values to perform 'sub'!" );
+					test_for_script_error( !current->pop( first ), "Not enough values to perform 'sub'!" );
+					
+					current->push( IrrealValue( TYPE_INTEGER, STATE_OK, first.getInteger() - second.getInteger() ) );
+				}
+				break;
+
+				case CMD_MUL:
+				{
+					IrrealValue first, second;
+					test_for_script_error( !current->pop( first ), "Not enough values to perform 'mul'!" );
+					test_for_script_error( !current->pop( second ), "Not enough values to perform 'mul'!" );
+					
+					current->push( IrrealValue( TYPE_INTEGER, STATE_OK, first.getInteger() * second.getInteger() ) );
+				}
+				break;
+
+				case CMD_DIV:
+				{
+					IrrealValue first, second;
+					test_for_script_error( !current->pop( second ), "Not enough values to perform 'div'!" );
+					test_for_script_error( !current->pop( first ), "Not enough values to perform 'div'!" );
+					
+					int64_t dividend = first.getInteger(), divisor = second.getInteger();
+					test_for_script_error( divisor == 0, "DIV: Division by zero!" );
+					test_for_script_error( dividend == INT64_MIN && divisor == -1, "DIV: Integer overflow!" );
+					
+					current->push( IrrealValue( TYPE_INTEGER, STATE_OK, dividend / divisor ) );
+				}
+				break;
+
+				case CMD_MOD:
+				{
+					IrrealValue first, second;
+					test_for_script_error( !current->pop( second ), "Not enough values to perform 'mod'!" );
+					test_for_script_error( !current->pop( first ), "Not enough values to perform 'mod'!" );
+					
+					int64_t dividend = first.getInteger(), divisor = second.getInteger();
+					test_for_script_error( divisor == 0, "MOD: Division by zero!" );
+					test_for_script_error( dividend == INT64_MIN && divisor == -1, "MOD: Integer overflow!" );
+					
+					current->push( IrrealValue( TYPE_INTEGER, STATE_OK, dividend % divisor ) );
+				}
+				break;
+
+				case CMD_LENGTH:
+				{
+					IrrealValue value;
+					
+					test_for_script_error( !current->pop( value ), "Not enough values to perform 'length'!" );
+					
+					IrrealStack *target_stack = ctx->getStack( &value );
+					
+					test_for_script_error( target_stack == NULL, "LENGTH: Stack not found!" );
+					
+					current->push( IrrealValue( TYPE_INTEGER, STATE_OK, (int64_t)target_stack->size() ) );
+				
+				}
+				break;
+				
+				case CMD_MACRO:
+				{
+					IrrealValue value;
+					
+					test_for_script_error( !current->pop( value ), "Not enough values to perform 'macro'!" );
+					
+					//printf( "MACRO: debug: stack name = '%s'\n", value->getValue().c_str() );
+					
+					IrrealStack *source_stack = ctx->getStack( &value );
+					
+					test_for_script_error( source_stack == NULL, "MACRO: Invalid source stack!" );
+					
+					ctx->pushStackFrame( source_stack, true );
+					
+				}
+				break;
+				
+				case CMD_SWAP:
+				{
+					IrrealValue stack_name, value0, value1;
+					IrrealStack *target_stack;
+					
+					test_for_script_error( !current->pop( stack_name ), "Not enough values to perform 'swap'!" );
+					
+					target_stack = ctx->getStack( &stack_name );
+					
+					test_for_script_error( target_stack == NULL, "SWAP: Invalid stack!" );
+					
+					test_for_script_error( !target_stack->pop( value0 ), "SWAP: Not enough values in target stack!" );
+					test_for_script_error( !target_stack->pop( value1 ), "SWAP: Not enough values in target stack!" );
+					
+					target_stack->push( value0 );
+					target_stack->push( value1 );
+					
+				
+				}
+				break;
+				
+				case CMD_ROTL:
+				case CMD_ROTR:
+				{
+					IrrealValue stack_name;
+					IrrealStack *target_stack;
+					
+					test_for_script_error( !current->pop( stack_name ), "Not enough values to perform 'rotl' or 'rotr'!" );
+					
+					target_stack = ctx->getStack( &stack_name );
+					
+					test_for_script_error( target_stack == NULL, "ROTL/ROTR: Invalid stack!" );
+					
+					target_stack->rotate_stack( q->getType() == CMD_ROTL );
+				}
+				break;
+				
+				default:
+				break;
+				}
+			}
+		else{
+			current->push( *q );
+			}
+		
+		}
+	
+	
+	ctx->unlock_context();
+	
+	// The context goes away once its callees are done as well. A parked
+	// context may already run elsewhere, so it must not be touched here.
+	if( finished ){
+		ctx->release();
+		}
+	return finished;
+	}
+
+
+std::string trim( const std::string str ){
+	size_t start, stop;
+	start = str.find_first_not_of( WHITESPACE );
+	stop = str.find_last_not_of( WHITESPACE );
+	return str.substr( start, stop-start+1 );
+	} 
+
+void print_lines( std::vector< std::string > lines ){
+	for( size_t i = 0 ; i < lines.size() ; ++i ){
+		printf( "%lu: '%s'\n", i, lines[i].c_str() );
+		}
+	} 
+
+#define KEYWORD( name, cmd ) \
+	if( str.compare( name ) == 0 ){ return cmd; }
+
+// Command of a keyword or 0, candidates are picked by length and first
+// character so that at most a couple of compares are done per token
+uint8_t keyword_command( std::string_view str ){
+	switch( str.size() ){
+		case 1:
+			KEYWORD( "{", CMD_BEGIN );
+			KEYWORD( "}", CMD_END );
+		break;
+		case 2:
+			KEYWORD( "if", CMD_IF );
+		break;
+		case 3:
+			switch( str[0] ){
+				case 'p': KEYWORD( "pop", CMD_POP ); break;
+				case 'd': KEYWORD( "def", CMD_DEF ); KEYWORD( "div", CMD_DIV ); KEYWORD( "dup", CMD_DUP ); break;
+				case 'a': KEYWORD( "add", CMD_ADD ); break;
+				case 's': KEYWORD( "sub", CMD_SUB ); break;
+				case 'm': KEYWORD( "mul", CMD_MUL ); KEYWORD( "mod", CMD_MOD ); break;
+				}
+		break;
+		case 4:
+			switch( str[0] ){
+				case 'p': KEYWORD( "push", CMD_PUSH ); KEYWORD( "pmap", CMD_PMAP ); break;
+				case 'c': KEYWORD( "call", CMD_CALL ); break;
+				case 'j': KEYWORD( "join", CMD_JOIN ); break;
+				case 's': KEYWORD( "sync", CMD_SYNC ); KEYWORD( "swap", CMD_SWAP ); break;
+				case 'r': KEYWORD( "rotl", CMD_ROTL ); KEYWORD( "rotr", CMD_ROTR ); break;
+				}
+		break;
+		case 5:
+			switch( str[0] ){
+				case 'm': KEYWORD( "merge", CMD_MERGE ); KEYWORD( "macro", CMD_MACRO ); break;
+				case 'p': KEYWORD( "print", CMD_PRINT ); break;
+				case 'w': KEYWORD( "while", CMD_WHILE ); break;
+				case 'c': KEYWORD( "call!", CMD_CALL_SYNC ); break;
+				case 's': KEYWORD( "spawn", CMD_SPAWN ); break;
+				}
+		break;
+		case 6:
+			KEYWORD( "length", CMD_LENGTH );
+		break;
+		case 7:
+			KEYWORD( "preduce", CMD_PREDUCE );
+		break;
+		}
+	return 0;
+	}
+
+#undef KEYWORD
+
+// Returns an error message if the token can't be compiled
+const char* extract_value( std::string_view str, IrrealValue *out ){
+	if( str.find_first_not_of( NUMBERS ) == std::string_view::npos ){
+		int64_t integer = 0;
+		std::from_chars_result result = std::from_chars( str.data(), str.data() + str.size(), integer );
+		if( result.ec != std::errc() ){
+			return "Integer literal out of range!";
+			}
+		*out = IrrealValue( TYPE_INTEGER, STATE_OK, integer );
+		return NULL;
+		}
+	
+	uint8_t cmd = keyword_command( str );
+	if( cmd != 0 ){
+		*out = IrrealValue( cmd, STATE_OK, (int64_t) 0 );
+		return NULL;
+		}
+	
+	// Symbol ids share the payload with integers
+	*out = IrrealValue( TYPE_SYMBOL, STATE_OK, (int64_t) intern_symbol( str ) );
+	return NULL;
+	}
+
+// Single pass over the source, tokens are views into the text and go 
+// straight into the program. The blocks are not resolved yet. Returns
+// NULL with 'error' set if a token can't be compiled.
+IrrealCode* parse( std::string_view text, const char **error ){
+	IrrealCode *out = new IrrealCode();
+	IrrealValue value;
+	
+	size_t i = 0;
+	while( i < text.size() ){
+		while( i < text.size() && ( text[i] == ' ' || text[i] == '\t' || text[i] == '\n' ) ){
+			++i;
+			}
+		size_t start = i;
+		while( i < text.size() && text[i] != ' ' && text[i] != '\t' && text[i] != '\n' ){
+			++i;
+			}
+		if( i > start ){
+			*error = extract_value( text.substr( start, i - start ), &value );
+			if( *error != NULL ){
+				delete out;
+				return NULL;
+				}
+			IrrealCodeBuilder::append( out, value );
+			}
+		}
+	return out;
+	}
+
+IrrealCode* compile_program( std::string_view text, std::string *error ){
+	const char *message = NULL;
+	IrrealCode *out = parse( text, &message );
+	if( out == NULL ){
+		*error = message;
+		return NULL;
+		}
+	
+	message = IrrealCodeBuilder::resolveBlocks( out );
+	if( message != NULL ){
+		*error = message;
+		delete out;
+		return NULL;
+		}
+	
+	out->retain();
+	return out;
+	}
+
+// Pins worker to a single cpu, workers are spread round robin over the
+// cpus the process is allowed to run on
+void pin_thread( size_t thread_id ){
+	cpu_set_t set;
+	std::vector< int > cpus;
+	
+	CPU_ZERO( &set );
+	if( sched_getaffinity( 0, sizeof( set ), &set ) != 0 ){ return; }
+	
+	for( int i = 0 ; i < CPU_SETSIZE ; ++i ){
+		if( CPU_ISSET( i, &set ) ){
+			cpus.push_back( i );
+			}
+		}
+	if( cpus.size() < 1 ){ return; }
+	
+	CPU_ZERO( &set );
+	CPU_SET( cpus[ thread_id % cpus.size() ], &set );
+	
+	if( pthread_setaffinity_np( pthread_self(), sizeof( set ), &set ) != 0 ){
+		fprintf( stderr, "Warning: unable to pin worker %lu \n", thread_id );
+		}
+	}
+
+struct IrrealWorkerArgs {
+	IrrealVM *vm;
+	size_t thread_id;
+	};
+
+void* IrrealVM :: worker_thread( void *args ){
+	IrrealVM *vm = ( (IrrealWorkerArgs *)args )->vm;
+	size_t thread_id = ( (IrrealWorkerArgs *)args )->thread_id;
+	
+	delete (IrrealWorkerArgs *)args;
+	
+	if( vm->pin_threads ){
+		pin_thread( thread_id );
+		}
+	
+	while( __atomic_load_n( &vm->running_vms, __ATOMIC_SEQ_CST ) > 0 ){
+		
+		uint64_t seq = __atomic_load_n( &vm->work_seq, __ATOMIC_SEQ_CST );
+		
+		vm->running_threads[ thread_id ] = true;
+		
+		bool worked = vm->execute( thread_id );
+		
+		vm->running_threads[ thread_id ] = false;
+		
+		if( !worked ){
+			vm->wait_for_work( seq );
+			}
+		}
+	
+	release_thread_pools();
+	pthread_exit( NULL );
+	}
+
+// Workers are started right away and wait for programs to run
+IrrealVM :: IrrealVM( size_t aNumThreads, bool aPinThreads ){
+	
+	num_threads = aNumThreads > 0 ? aNumThreads : 1;
+	pin_threads = aPinThreads;
+	print_file = stdout;
+	
+	running_threads = new bool[ num_threads ];
+	running_threads_vm = new uint64_t[ num_threads ];
+	work_queues = new IrrealWorkQueue[ num_threads ];
+	trace_buffers = global_trace_enabled ? new IrrealTraceBuffer[ num_threads ] : NULL;
+	
+	for( size_t i = 0 ; i < num_threads ; ++i ){
+		running_threads[ i ] = false;
+		running_threads_vm[ i ] = 0;
+		}
+	
+	pthread_mutex_init( &idle_lock, NULL );
+	pthread_cond_init( &idle_cond, NULL );
+	idle_workers = 0;
+	work_seq = 0;
+	next_queue = 0;
+	running_vms = 1;
+	
+	workers = new pthread_t[ num_threads ];
+	
+	pthread_attr_t attr;
+	pthread_attr_init( &attr );
+	pthread_attr_setdetachstate( &attr, PTHREAD_CREATE_JOINABLE );
+	
+	for( size_t i = 0 ; i < num_threads ; ++i ){
+		IrrealWorkerArgs *args = new IrrealWorkerArgs();
+		args->vm = this;
+		args->thread_id = i;
+		pthread_create( &workers[i], &attr, worker_thread, (void *)args );
+		}
+	
+	pthread_attr_destroy( &attr );
+	}
+
+// Waits for everything still running, including calls nobody synced on
+IrrealVM :: ~IrrealVM(){
+	void *status;
+	
+	vm_finished();
+	
+	for( size_t i = 0 ; i < num_threads ; ++i ){
+		pthread_join( workers[i], &status ); 
+		}
+	
+	if( trace_buffers != NULL ){
+		for( size_t i = 0 ; i < num_threads ; ++i ){
+			trace_buffers[i].flush();
+			}
+		delete[] trace_buffers;
+		}
+	
+	delete[] workers;
+	delete[] work_queues;
+	delete[] running_threads;
+	delete[] running_threads_vm;
+	
+	pthread_mutex_destroy( &idle_lock );
+	pthread_cond_destroy( &idle_cond );
+	}
+
+// Runs the program in a new root context, the result is delivered to the
+// returned future which the caller passes on to 'wait'
+IrrealFuture* IrrealVM :: start( IrrealCode *program, const std::vector< IrrealValue > &params ){
+	IrrealContext *context = IrrealContext::create();
+	IrrealFuture *future = new IrrealFuture();
+	
+	future->retain();
+	
+	context->lock_context();
+	context->setFuture( future );
+	
+	IrrealStack *stack = context->getParamsStack();
+	for( size_t i = 0 ; i < params.size() ; ++i ){
+		stack->push( params[i] );
+		}
+	
+	context->pushFrame( program, 0, program->size() );
+	context->unlock_context();
+	
+	uint64_t queue = __sync_fetch_and_add( &next_queue, 1 ) % num_threads;
+	vm_started( 1 );
+	schedule_context( queue, context, true );
+	
+	return future;
+	}
+
+bool IrrealVM :: isReady( IrrealFuture *future ){ return future->isReady(); }
+
+// Blocks until the program is done and releases the future. Returns false
+// with 'error' set if any context of the program failed.
+bool IrrealVM :: wait( IrrealFuture *future, std::vector< IrrealValue > &out, std::string *error ){
+	future->block();
+	
+	// The result has the values of OUT in pop order
+	out.clear();
+	
+	const std::string *message = future->getError();
+	if( message != NULL ){
+		*error = *message;
+		future->release();
+		return false;
+		}
+	
+	future->getResult()->copyTo( out, true );
+	future->release();
+	return true;
+	}
+
+bool IrrealVM :: run( IrrealCode *program, const std::vector< IrrealValue > &params, std::vector< IrrealValue > &out, std::string *error ){
+	return wait( start( program, params ), out, error );
+	}
+
+void IrrealVM :: setPrintFile( FILE *aPrintFile ){ print_file = aPrintFile; }
+
+// Maps a whole file read-only, an empty file gives an empty view
+bool map_file( const char *fn, std::string_view *out ){
+	int fd = open( fn, O_RDONLY );
+	if( fd < 0 ){
+		return false;
+		}
+	
+	struct stat st;
+	if( fstat( fd, &st ) != 0 ){
+		close( fd );
+		return false;
+		}
+	
+	size_t size = st.st_size;
+	if( size == 0 ){
+		close( fd );
+		*out = std::string_view();
+		return true;
+		}
+	
+	void *data = mmap( NULL, size, PROT_READ, MAP_PRIVATE, fd, 0 );
+	close( fd );
+	if( data == MAP_FAILED ){
+		return false;
+		}
+	
+	*out = std::string_view( (const char*) data, size );
+	return true;
+	}
+
+void unmap_file( std::string_view data ){
+	if( data.size() > 0 ){
+		munmap( (void*) data.data(), data.size() );
+		}
+	}
+
+// Compiled programs are cached next to their source in a '.irrc' file,
+// which is only used while the hash of the source still matches. It holds
+// the symbols used by the program followed by the instructions, symbol 
+// payloads index into the file's own table and are interned again when
+// it is loaded. Numbers are stored in host byte order.
+#define CACHE_MAGIC		0x43525249	// "IRRC"
+#define CACHE_VERSION	1
+
+struct IrrealCacheHeader {
+	uint32_t magic, version;
+	uint64_t source_hash, source_size;
+	uint64_t num_symbols, symbols_size, num_instructions;
+	};
+
+struct IrrealCacheInstruction {
+	int64_t payload;
+	uint64_t block_end;
+	uint8_t type, state;
+	uint8_t padding[6];
+	};
+
+// FNV-1a
+uint64_t hash_source( std::string_view text ){
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for( size_t i = 0 ; i < text.size() ; ++i ){
+		hash ^= (uint8_t) text[i];
+		hash *= 0x100000001b3ULL;
+		}
+	return hash;
+	}
+
+std::string cache_path( const char *fn ){
+	std::string out( fn );
+	if( out.size() > 4 && out.compare( out.size() - 4, 4, ".irr" ) == 0 ){
+		out.resize( out.size() - 4 );
+		}
+	return out + ".irrc";
+	}
+
+// Returns NULL when there is no usable cache for this source
+IrrealCode* load_cache( const std::string &fn, uint64_t hash, uint64_t size ){
+	std::string_view data;
+	if( !map_file( fn.c_str(), &data ) ){
+		return NULL;
+		}
+	
+	IrrealCacheHeader header;
+	if( data.size() < sizeof( header ) ){
+		unmap_file( data );
+		return NULL;
+		}
+	memcpy( &header, data.data(), sizeof( header ) );
+	
+	size_t offset = sizeof( header );
+	size_t code_size = header.num_instructions * sizeof( IrrealCacheInstruction );
+	if( header.magic != CACHE_MAGIC || header.version != CACHE_VERSION ||
+		header.source_hash != hash || header.source_size != size ||
+		header.symbols_size > data.size() - offset ||
+		header.num_instructions > data.size() / sizeof( IrrealCacheInstruction ) ||
+		code_size != data.size() - offset - header.symbols_size ){
+		unmap_file( data );
+		return NULL;
+		}
+	
+	std::vector< uint64_t > symbols;
+	size_t end = offset + header.symbols_size;
+	for( uint64_t i = 0 ; i < header.num_symbols ; ++i ){
+		uint32_t length;
+		if( end - offset < sizeof( length ) ){
+			unmap_file( data );
+			return NULL;
+			}
+		memcpy( &length, data.data() + offset, sizeof( length ) );
+		offset += sizeof( length );
+		if( end - offset < length ){
+			unmap_file( data );
+			return NULL;
+			}
+		symbols.push_back( intern_symbol( data.substr( offset, length ) ) );
+		offset += length;
+		}
+	offset = end;
+	
+	IrrealCode *out = new IrrealCode();
+	for( uint64_t i = 0 ; i < header.num_instructions ; ++i ){
+		IrrealCacheInstruction q;
+		memcpy( &q, data.data() + offset + i * sizeof( q ), sizeof( q ) );
+		
+		int64_t payload = q.payload;
+		bool valid = q.type == TYPE_INTEGER || q.type == TYPE_SYMBOL || q.type == TYPE_STRING ||
+			( q.type >= CMD_BEGIN && q.type <= CMD_SPAWN );
+		if( q.type == CMD_BEGIN && q.block_end > i && q.block_end < header.num_instructions ){
+			IrrealCacheInstruction block_end;
+			memcpy( &block_end, data.data() + offset + q.block_end * sizeof( q ), sizeof( q ) );
+			valid = block_end.type == CMD_END;
+			}
+		else if( q.type == CMD_BEGIN ){
+			valid = false;
+			}
+		if( !valid ){
+			delete out;
+			unmap_file( data );
+			return NULL;
+			}
+		
+		if( q.type == TYPE_SYMBOL || q.type == TYPE_STRING ){
+			if( (uint64_t) payload >= symbols.size() ){
+				delete out;
+				unmap_file( data );
+				return NULL;
+				}
+			payload = symbols[ payload ];
+			}
+		if( q.block_end >= header.num_instructions ){
+			delete out;
+			unmap_file( data );
+			return NULL;
+			}
+		
+		IrrealCodeBuilder::append( out, IrrealValue( q.type, q.state, payload ), q.block_end );
+		}
+	
+	unmap_file( data );
+	return out;
+	}
+
+// Written to a temporary file first so that readers never see half of it,
+// failing to write the cache is not an error
+void save_cache( const std::string &fn, IrrealCode *program, uint64_t hash, uint64_t size ){
+	std::map< uint64_t, uint64_t > local_ids;
+	std::vector< std::string > names;
+	std::vector< IrrealCacheInstruction > code( program->size() );
+	
+	for( size_t i = 0 ; i < program->size() ; ++i ){
+		IrrealValue *value = program->at( i );
+		IrrealCacheInstruction &q = code[i];
+		
+		memset( &q, 0, sizeof( q ) );
+		q.type = value->getType();
+		q.state = value->getState();
+		q.block_end = program->blockEnd( i );
+		
+		switch( q.type ){
+			case TYPE_INTEGER:
+				q.payload = value->getInteger();
+			break;
+			case TYPE_SYMBOL:
+			case TYPE_STRING:
+			{
+				std::map< uint64_t, uint64_t >::iterator it = local_ids.find( value->getSymbol() );
+				if( it == local_ids.end() ){
+					it = local_ids.insert( std::make_pair( value->getSymbol(), names.size() ) ).first;
+					names.push_back( value->getValue() );
+					}
+				q.payload = it->second;
+			}
+			break;
+			default:
+				if( !( q.type & TYPE_OPERATOR ) ){
+					return;
+					}
+			}
+		}
+	
+	std::string symbols;
+	for( size_t i = 0 ; i < names.size() ; ++i ){
+		uint32_t length = names[i].size();
+		symbols.append( (const char*) &length, sizeof( length ) );
+		symbols.append( names[i] );
+		}
+	
+	IrrealCacheHeader header;
+	memset( &header, 0, sizeof( header ) );
+	header.magic = CACHE_MAGIC;
+	header.version = CACHE_VERSION;
+	header.source_hash = hash;
+	header.source_size = size;
+	header.num_symbols = names.size();
+	header.symbols_size = symbols.size();
+	header.num_instructions = code.size();
+	
+	std::string tmp_fn = fn + "." + integer_to_string( getpid() );
+	FILE *handle = fopen( tmp_fn.c_str(), "wb" );
+	if( handle == NULL ){
+		return;
+		}
+	
+	bool ok = fwrite( &header, sizeof( header ), 1, handle ) == 1;
+	ok = ok && ( symbols.size() == 0 || fwrite( symbols.data(), symbols.size(), 1, handle ) == 1 );
+	ok = ok && ( code.size() == 0 || fwrite( &code[0], sizeof( IrrealCacheInstruction ), code.size(), handle ) == code.size() );
+	ok = fclose( handle ) == 0 && ok;
+	
+	if( !ok || rename( tmp_fn.c_str(), fn.c_str() ) != 0 ){
+		unlink( tmp_fn.c_str() );
+		}
+	}
+
+// Uses the cached program when the source did not change, otherwise
+// compiles the source in place and refreshes the cache
+IrrealCode* load_program( const char *fn, bool use_cache, std::string *error ){
+	std::string_view text;
+	if( !map_file( fn, &text ) ){
+		*error = std::string( "Could not read file '" ) + fn + "'!";
+		return NULL;
+		}
+	
+	uint64_t hash = 0;
+	IrrealCode *program = NULL;
+	
+	if( use_cache ){
+		hash = hash_source( text );
+		program = load_cache( cache_path( fn ), hash, text.size() );
+		if( program != NULL ){
+			program->retain();
+			}
+		}
+	
+	if( program == NULL ){
+		madvise( (void*) text.data(), text.size(), MADV_SEQUENTIAL );
+		program = compile_program( text, error );
+		if( program != NULL && use_cache ){
+			save_cache( cache_path( fn ), program, hash, text.size() );
+			}
+		}
+	
+	unmap_file( text );
+	return program;
+	}
+
@@ -0,0 +1,200 @@
+#ifndef IRREAL_H
+#define IRREAL_H
+
+#include <cstdio>
+#include <stdint.h>
+#include <vector>
+#include <string>
+#include <string_view>
+#include <pthread.h>
+
+#define TYPE_OPERATOR 	128
+#define TYPE_INTEGER 	2
+#define TYPE_SYMBOL 	3
+#define TYPE_STRING 	4
+#define TYPE_SENTINEL	5
+#define TYPE_STACK		6
+
+#define STATE_OK 		0
+#define STATE_NOT_YET 	1
+#define STATE_JOINING 	2
+#define STATE_SYNCING 	3
+
+class IrrealStack;
+class IrrealFuture;
+class IrrealContext;
+class IrrealWorkQueue;
+class IrrealTraceBuffer;
+struct IrrealFrame;
+struct IrrealRange;
+struct IrrealJob;
+
+// Prints the error and exits, for errors outside of running scripts
+void test_for_error( bool, std::string );
+
+// Hands the objects pooled by the calling thread back to the process,
+// for threads that ran or waited on programs and are about to exit
+void release_thread_pools();
+
+// Symbols are shared by all VMs in the process and never freed
+uint64_t intern_symbol( std::string_view );
+std::string symbol_name( uint64_t );
+size_t symbol_count();
+
+// Values are stored in stacks and code by value. Integers keep their
+// payload as a native int64, symbols and strings as an interned id.
+// Anonymous stacks (blocks, call parameters) are referenced directly and
+// a sentinel refers to the future of a call until its result is ready,
+// both are reference counted by the values pointing to them. Those can't
+// be made from a string or an integer, the constructors throw
+// std::invalid_argument, use new_stack() instead.
+class IrrealValue {
+	public:
+		IrrealValue();
+		IrrealValue( uint8_t, uint8_t, std::string );
+		IrrealValue( uint8_t, uint8_t, int64_t );
+		IrrealValue( uint8_t, uint8_t, IrrealStack * );
+		IrrealValue( IrrealFuture * );
+		IrrealValue( const IrrealValue & );
+		IrrealValue( IrrealValue && );
+		~IrrealValue();
+		IrrealValue& operator=( const IrrealValue & );
+		IrrealValue& operator=( IrrealValue && );
+		
+		uint8_t getType();
+		uint8_t getState();
+		void setValue( std::string );
+		
+		std::string getValue();
+		int64_t getInteger();
+		uint64_t getSymbol();
+		IrrealStack* getStack();
+		IrrealFuture* getFuture();
+		
+	private:
+		void retain();
+		void release();
+		
+		uint8_t type, state;
+		union {
+			int64_t integer;
+			uint64_t symbol;
+			IrrealStack *stack;
+			IrrealFuture *future;
+			};
+	};
+
+// Compiled, immutable instruction array. Every block opener has the
+// position of its matching block end resolved when the code is linked.
+class IrrealCode {
+	public:
+		IrrealCode();
+		size_t size();
+		IrrealValue* at( size_t );
+		size_t blockEnd( size_t );
+		
+		void retain();
+		void release();
+		
+	private:
+		// Code is only built by the library, see compile_program
+		friend struct IrrealCodeBuilder;
+		void append( const IrrealValue & );
+		void append( const IrrealValue &, size_t );
+		void appendStack( IrrealStack *, bool );
+		const char* resolveBlocks();
+		
+		std::vector< IrrealValue > instructions;
+		std::vector< size_t > block_ends;
+		uint64_t refs;
+	};
+
+// Both return a program retained for the caller, or NULL with 'error'
+// set. Files are compiled through their '.irrc' cache if 'use_cache'.
+IrrealCode* load_program( const char *, bool, std::string * );
+IrrealCode* compile_program( std::string_view, std::string * );
+
+// Helpers for natives, stack values are read bottom first and a new 
+// stack gets the values pushed in order
+void stack_values( IrrealValue &, std::vector< IrrealValue > & );
+IrrealValue new_stack( const std::vector< IrrealValue > & );
+
+// Native function, gets the parameters of the call bottom first and 
+// leaves its results in the second vector as it would push them to OUT.
+// Throwing a std::exception fails the calling script with its what().
+typedef void (*IrrealNative)( std::vector< IrrealValue > &, std::vector< IrrealValue > &, void * );
+
+struct IrrealNativeEntry {
+	IrrealNative function;
+	void *data;
+	};
+
+// Tracing is set up for the whole process, before the VMs are created
+void set_trace_ops( const char * );
+void set_trace_contexts( const char * );
+void set_trace_binary( bool );
+void init_tracing( const char * );
+void finish_tracing();
+
+// A VM owns its workers and their run queues, any number of VMs can run
+// side by side. Every program started runs in a root context of its own,
+// the PARAMS given are pushed in order and OUT is returned bottom first.
+// An error in a script fails its program instead of the process.
+class IrrealVM {
+	public:
+		IrrealVM( size_t, bool );
+		~IrrealVM();
+		
+		IrrealFuture* start( IrrealCode *, const std::vector< IrrealValue > & );
+		bool isReady( IrrealFuture * );
+		bool wait( IrrealFuture *, std::vector< IrrealValue > &, std::string * );
+		bool run( IrrealCode *, const std::vector< IrrealValue > &, std::vector< IrrealValue > &, std::string * );
+		
+		void setPrintFile( FILE * );
+		void registerNative( std::string_view, IrrealNative, void * );
+		
+	private:
+		static void* worker_thread( void * );
+		bool execute( uint64_t );
+		bool run( uint64_t, IrrealContext *, size_t );
+		bool interpret( uint64_t, IrrealContext *, size_t );
+		void finish_context( uint64_t, IrrealContext * );
+		void fail_context( uint64_t, IrrealContext *, const std::string & );
+		
+		void schedule_context( uint64_t, IrrealContext *, bool );
+		void schedule_contexts( uint64_t, const std::vector< IrrealContext* > & );
+		void wait_for_work( uint64_t );
+		void vm_started( uint64_t );
+		void vm_finished();
+		IrrealContext* next_context( uint64_t );
+		
+		void wake_waiters( uint64_t, IrrealContext * );
+		void finish_job( uint64_t, IrrealJob * );
+		bool step_job( uint64_t, IrrealContext *, IrrealFrame * );
+		void spawn_job( uint64_t, IrrealContext *, IrrealJob *, IrrealRange );
+		
+		IrrealNativeEntry* find_native( IrrealValue * );
+		IrrealValue call_native( IrrealContext *, IrrealNativeEntry *, size_t );
+		
+		void _debug_running_threads();
+		
+		size_t num_threads;
+		bool pin_threads;
+		FILE *print_file;
+		std::vector< IrrealNativeEntry > natives;
+		
+		pthread_t *workers;
+		IrrealWorkQueue *work_queues;
+		IrrealTraceBuffer *trace_buffers;
+		bool *running_threads;
+		uint64_t *running_threads_vm;
+		
+		// Idle workers sleep on the condition until work is scheduled or
+		// the last VM has finished. The instance itself counts as running
+		// until it is destroyed.
+		pthread_mutex_t idle_lock;
+		pthread_cond_t idle_cond;
+		uint64_t running_vms, idle_workers, work_seq, next_queue;
+	};
+
+#endif
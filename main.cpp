@@ -0,0 +1,320 @@
+#include <cstdlib>
+#include <cstring>
+#include <unordered_map>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <signal.h>
+#include <getopt.h>
+
+#include "irreal.h"
+
+// Worker count defaults to the number of online cpus
+size_t default_num_threads(){
+	const char *env = getenv( "IRREAL_WORKERS" );
+	
+	if( env != NULL && atol( env ) > 0 ){
+		return atol( env );
+		}
+	
+	// Only the cpus the process may run on, as under taskset or cgroups
+	cpu_set_t set;
+	if( sched_getaffinity( 0, sizeof( set ), &set ) == 0 && CPU_COUNT( &set ) > 0 ){
+		return CPU_COUNT( &set );
+		}
+	
+	long int cpus = sysconf( _SC_NPROCESSORS_ONLN );
+	
+	return cpus > 0 ? cpus : 1;
+	}
+
+void print_usage( const char *name ){
+	fprintf( stderr, "Usage: %s [options] file\n", name );
+	fprintf( stderr, "       %s [options] --serve PATH\n\n", name );
+	fprintf( stderr, "  -j, --workers N   number of worker threads (IRREAL_WORKERS)\n" );
+	fprintf( stderr, "  -p, --pin         pin workers to cpus (IRREAL_PIN=1)\n" );
+	fprintf( stderr, "  --no-cache        do not use or write '.irrc' files (IRREAL_CACHE=0)\n" );
+	fprintf( stderr, "  -s, --serve PATH  run programs sent to unix socket PATH ('-' for stdin)\n" );
+	fprintf( stderr, "  -t, --trace FILE  write execution trace to FILE ('-' for stderr)\n" );
+	fprintf( stderr, "  --trace-binary    write trace as binary records\n" );
+	fprintf( stderr, "  --trace-ops LIST  trace only listed commands, e.g. 'call,sync,value'\n" );
+	fprintf( stderr, "  --trace-ctx LIST  trace only listed context ids\n" );
+	fprintf( stderr, "\n" );
+	}
+
+// Server mode keeps the workers running between programs. Requests are
+// read from a unix socket, one thread per connection, or from stdin. 
+// Each request is "<size>\n" followed by the source of the program, 
+// which runs in a root context of its own. The reply is "ok <size>\n"
+// followed by the values left in OUT, one per line from the bottom, or
+// "error <size>\n" followed by a message. Compiled programs are kept by
+// their source, up to SERVER_CACHE_BYTES of source and code together.
+//
+// Symbols are interned for the life of the process, so new names sent by
+// clients take memory that is never given back. Once SERVER_MAX_SYMBOLS
+// exist only programs already in the cache are run, others get an error.
+#define SERVER_CACHE_BYTES		( 256 << 20 )
+#define SERVER_MAX_PROGRAM		( 64 << 20 )
+#define SERVER_MAX_SYMBOLS		( 1 << 24 )
+
+IrrealVM *global_server_vm;
+std::unordered_map< std::string, IrrealCode* > global_server_programs;
+size_t global_server_cache_bytes = 0;
+pthread_mutex_t global_server_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Source kept as the key plus the instructions and their block ends
+size_t server_program_bytes( const std::string &source, IrrealCode *program ){
+	return source.size() + program->size() * ( sizeof( IrrealValue ) + sizeof( size_t ) );
+	}
+
+// Returns the program retained for the caller, or NULL with 'error' set
+IrrealCode* server_program( const std::string &source, std::string *error ){
+	IrrealCode *out = NULL;
+	
+	pthread_mutex_lock( &global_server_lock );
+	std::unordered_map< std::string, IrrealCode* >::iterator it = global_server_programs.find( source );
+	if( it != global_server_programs.end() ){
+		out = it->second;
+		out->retain();
+		}
+	pthread_mutex_unlock( &global_server_lock );
+	
+	if( out != NULL ){
+		return out;
+		}
+	
+	if( symbol_count() >= SERVER_MAX_SYMBOLS ){
+		*error = "Symbol limit reached!";
+		return NULL;
+		}
+	
+	out = compile_program( source, error );
+	if( out == NULL ){
+		return NULL;
+		}
+	
+	// Programs bigger than the whole cache are run but not kept
+	size_t bytes = server_program_bytes( source, out );
+	
+	pthread_mutex_lock( &global_server_lock );
+	if( bytes <= SERVER_CACHE_BYTES && global_server_programs.find( source ) == global_server_programs.end() ){
+		if( global_server_cache_bytes + bytes > SERVER_CACHE_BYTES ){
+			for( it = global_server_programs.begin() ; it != global_server_programs.end() ; ++it ){
+				it->second->release();
+				}
+			global_server_programs.clear();
+			global_server_cache_bytes = 0;
+			}
+		out->retain();
+		global_server_programs[ source ] = out;
+		global_server_cache_bytes += bytes;
+		}
+	pthread_mutex_unlock( &global_server_lock );
+	
+	return out;
+	}
+
+void server_reply( FILE *out, const char *status, const std::string &payload ){
+	fprintf( out, "%s %lu\n", status, payload.size() );
+	fwrite( payload.data(), 1, payload.size(), out );
+	fflush( out );
+	}
+
+// Serves requests until the input is closed or malformed
+void serve_stream( FILE *in, FILE *out ){
+	char header[32];
+	
+	while( fgets( header, sizeof( header ), in ) != NULL ){
+		char *end;
+		unsigned long size = strtoul( header, &end, 10 );
+		if( end == header || *end != '\n' || size > SERVER_MAX_PROGRAM ){
+			server_reply( out, "error", "Malformed request!" );
+			return;
+			}
+		
+		std::string source( size, '\0' );
+		if( size > 0 && fread( &source[0], 1, size, in ) != size ){
+			return;
+			}
+		
+		std::string error;
+		IrrealCode *program = server_program( source, &error );
+		if( program == NULL ){
+			server_reply( out, "error", error );
+			continue;
+			}
+		
+		std::vector< IrrealValue > values;
+		bool ok = global_server_vm->run( program, std::vector< IrrealValue >(), values, &error );
+		program->release();
+		
+		if( !ok ){
+			server_reply( out, "error", error );
+			continue;
+			}
+		
+		std::string result;
+		for( size_t i = 0 ; i < values.size() ; ++i ){
+			result += values[i].getValue();
+			result += "\n";
+			}
+		server_reply( out, "ok", result );
+		}
+	}
+
+void *connection_thread( void *args ){
+	int fd = (int)(size_t)args;
+	FILE *in = fdopen( fd, "r" );
+	FILE *out = fdopen( dup( fd ), "w" );
+	
+	if( in != NULL && out != NULL ){
+		serve_stream( in, out );
+		}
+	
+	if( in != NULL ){ fclose( in ); } else { close( fd ); }
+	if( out != NULL ){ fclose( out ); }
+	
+	release_thread_pools();
+	return NULL;
+	}
+
+// Accepts connections until the process is stopped
+void serve_socket( const char *path ){
+	struct sockaddr_un addr;
+	
+	test_for_error( strlen( path ) >= sizeof( addr.sun_path ), "Socket path too long!" );
+	
+	memset( &addr, 0, sizeof( addr ) );
+	addr.sun_family = AF_UNIX;
+	strcpy( addr.sun_path, path );
+	
+	int listener = socket( AF_UNIX, SOCK_STREAM, 0 );
+	test_for_error( listener < 0, "Unable to create socket!" );
+	
+	unlink( path );
+	test_for_error( bind( listener, (struct sockaddr *)&addr, sizeof( addr ) ) != 0, std::string( "Unable to bind '" ) + path + "'!" );
+	test_for_error( listen( listener, 64 ) != 0, "Unable to listen on socket!" );
+	
+	pthread_attr_t attr;
+	pthread_attr_init( &attr );
+	pthread_attr_setdetachstate( &attr, PTHREAD_CREATE_DETACHED );
+	
+	while( true ){
+		int fd = accept( listener, NULL, NULL );
+		if( fd < 0 ){
+			continue;
+			}
+		
+		pthread_t connection;
+		if( pthread_create( &connection, &attr, connection_thread, (void *)(size_t)fd ) != 0 ){
+			close( fd );
+			}
+		}
+	}
+
+int main( int argc, char **argv ){
+
+	size_t num_threads = default_num_threads();
+	
+	const char *pin_env = getenv( "IRREAL_PIN" );
+	bool pin_threads = pin_env != NULL && atol( pin_env ) > 0;
+	
+	const char *cache_env = getenv( "IRREAL_CACHE" );
+	bool use_cache = cache_env == NULL || atol( cache_env ) > 0;
+	
+	static struct option long_options[] = {
+		{ "workers", required_argument, NULL, 'j' },
+		{ "pin", no_argument, NULL, 'p' },
+		{ "no-cache", no_argument, NULL, 'N' },
+		{ "serve", required_argument, NULL, 's' },
+		{ "trace", required_argument, NULL, 't' },
+		{ "trace-binary", no_argument, NULL, 'B' },
+		{ "trace-ops", required_argument, NULL, 'O' },
+		{ "trace-ctx", required_argument, NULL, 'C' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+		};
+	
+	const char *trace_fn = NULL;
+	const char *serve_path = NULL;
+	
+	int opt;
+	while( ( opt = getopt_long( argc, argv, "j:pt:s:h", long_options, NULL ) ) != -1 ){
+		switch( opt ){
+			case 'j':
+				test_for_error( atol( optarg ) < 1, "Invalid number of workers!" );
+				num_threads = atol( optarg );
+			break;
+			case 'p':
+				pin_threads = true;
+			break;
+			case 'N':
+				use_cache = false;
+			break;
+			case 's':
+				serve_path = optarg;
+			break;
+			case 't':
+				trace_fn = optarg;
+			break;
+			case 'B':
+				set_trace_binary( true );
+			break;
+			case 'O':
+				set_trace_ops( optarg );
+			break;
+			case 'C':
+				set_trace_contexts( optarg );
+			break;
+			default:
+				print_usage( argv[0] );
+				return 1;
+			}
+		}
+
+	if( optind >= argc && serve_path == NULL ){
+		print_usage( argv[0] );
+		return 1;
+		}
+
+	if( trace_fn != NULL ){
+		init_tracing( trace_fn );
+		}
+	
+	if( serve_path != NULL ){
+		signal( SIGPIPE, SIG_IGN );
+		
+		// stdout is kept for the replies
+		global_server_vm = new IrrealVM( num_threads, pin_threads );
+		global_server_vm->setPrintFile( stderr );
+		
+		if( strcmp( serve_path, "-" ) == 0 ){
+			serve_stream( stdin, stdout );
+			}
+		else{
+			serve_socket( serve_path );
+			}
+		
+		delete global_server_vm;
+		finish_tracing();
+		return 0;
+		}
+	
+	std::string error;
+	IrrealCode *program = load_program( argv[optind], use_cache, &error );
+	test_for_error( program == NULL, error );
+	
+	IrrealVM *vm = new IrrealVM( num_threads, pin_threads );
+	std::vector< IrrealValue > out;
+	
+	bool ok = vm->run( program, std::vector< IrrealValue >(), out, &error );
+	test_for_error( !ok, error );
+	program->release();
+	
+	// Also waits for calls still running that nobody synced on
+	delete vm;
+	finish_tracing();
+	
+	return 0;
+	}
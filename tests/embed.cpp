@@ -0,0 +1,174 @@
+// Runs programs through the library the way an embedding service would:
+// natives registered per VM, PARAMS passed in, OUT read back, two VMs
+// running side by side and a failing script reported to the caller.
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "irreal.h"
+
+int failures = 0;
+
+void check( bool ok, const char *what ){
+	if( !ok ){
+		fprintf( stderr, "FAIL: %s\n", what );
+		++failures;
+		}
+	}
+
+// x -> x * factor, the factor is the data given to the VM
+void scale( std::vector< IrrealValue > &params, std::vector< IrrealValue > &out, void *data ){
+	int64_t factor = *(int64_t *)data;
+	out.push_back( IrrealValue( TYPE_INTEGER, STATE_OK, params[0].getInteger() * factor ) );
+	}
+
+// n -> stack of 1 .. n
+void range( std::vector< IrrealValue > &params, std::vector< IrrealValue > &out, void * ){
+	std::vector< IrrealValue > values;
+	for( int64_t i = 1 ; i <= params[0].getInteger() ; ++i ){
+		values.push_back( IrrealValue( TYPE_INTEGER, STATE_OK, i ) );
+		}
+	out.push_back( new_stack( values ) );
+	}
+
+// stack -> sum of its values
+void total( std::vector< IrrealValue > &params, std::vector< IrrealValue > &out, void * ){
+	std::vector< IrrealValue > values;
+	stack_values( params[0], values );
+	
+	int64_t sum = 0;
+	for( size_t i = 0 ; i < values.size() ; ++i ){
+		sum += values[i].getInteger();
+		}
+	out.push_back( IrrealValue( TYPE_INTEGER, STATE_OK, sum ) );
+	}
+
+// Fails its call unless given a positive number
+void positive( std::vector< IrrealValue > &params, std::vector< IrrealValue > &out, void * ){
+	if( params[0].getInteger() <= 0 ){
+		throw std::invalid_argument( "positive: Not a positive number!" );
+		}
+	out.push_back( params[0] );
+	}
+
+const char *program_source =
+	"PARAMS pop scale 1 call sync merge OUT push "
+	"PARAMS pop scale 1 call! merge OUT push "
+	"5 range 1 call sync merge r def "
+	"r total 1 call sync merge OUT push ";
+
+IrrealVM* create_vm( int64_t *factor ){
+	IrrealVM *vm = new IrrealVM( 2, false );
+	vm->registerNative( "scale", scale, factor );
+	vm->registerNative( "range", range, NULL );
+	vm->registerNative( "total", total, NULL );
+	vm->registerNative( "positive", positive, NULL );
+	return vm;
+	}
+
+// OUT comes back bottom first, the second parameter was popped first
+void check_result( std::vector< IrrealValue > &out, int64_t factor, const char *what ){
+	check( out.size() == 3, what );
+	if( out.size() == 3 ){
+		check( out[0].getInteger() == 20 * factor, what );
+		check( out[1].getInteger() == 10 * factor, what );
+		check( out[2].getInteger() == 15, what );
+		}
+	}
+
+// The script has to fail with the given message
+void check_error( IrrealVM *vm, const char *source, const char *message ){
+	std::string error;
+	std::vector< IrrealValue > params, out;
+	
+	IrrealCode *program = compile_program( source, &error );
+	check( program != NULL, source );
+	if( program == NULL ){
+		return;
+		}
+	
+	check( !vm->run( program, params, out, &error ), source );
+	check( error == message, source );
+	program->release();
+	}
+
+bool throws_raw( uint8_t type ){
+	try{
+		IrrealValue value( type, STATE_OK, (int64_t) 0 );
+		}
+	catch( const std::invalid_argument & ){
+		try{
+			IrrealValue value( type, STATE_OK, std::string( "x" ) );
+			}
+		catch( const std::invalid_argument & ){
+			return true;
+			}
+		}
+	return false;
+	}
+
+int main(){
+	std::string error;
+	IrrealCode *program = compile_program( program_source, &error );
+	check( program != NULL, "compile" );
+	if( program == NULL ){
+		return 1;
+		}
+	
+	int64_t factor_a = 2, factor_b = 3;
+	IrrealVM *vm_a = create_vm( &factor_a );
+	IrrealVM *vm_b = create_vm( &factor_b );
+	
+	std::vector< IrrealValue > params;
+	params.push_back( IrrealValue( TYPE_INTEGER, STATE_OK, (int64_t) 10 ) );
+	params.push_back( IrrealValue( TYPE_INTEGER, STATE_OK, (int64_t) 20 ) );
+	
+	// Both run at the same time, each with its own natives
+	IrrealFuture *future_a = vm_a->start( program, params );
+	IrrealFuture *future_b = vm_b->start( program, params );
+	
+	std::vector< IrrealValue > out_a, out_b;
+	check( vm_b->wait( future_b, out_b, &error ), "wait b" );
+	check( vm_a->wait( future_a, out_a, &error ), "wait a" );
+	check_result( out_a, factor_a, "result a" );
+	check_result( out_b, factor_b, "result b" );
+	
+	// A failing script only fails its program, the VM keeps working
+	IrrealCode *broken = compile_program( "1 OUT push missing pop", &error );
+	std::vector< IrrealValue > out;
+	check( !vm_a->run( broken, params, out, &error ), "error reported" );
+	check( error == "POP: Stack not found!", "error message" );
+	check( out.empty(), "no result on error" );
+	broken->release();
+	
+	// Errors that would otherwise trap in the worker
+	check_error( vm_a, "1 0 div OUT push", "DIV: Division by zero!" );
+	check_error( vm_a, "1 0 mod OUT push", "MOD: Division by zero!" );
+	check_error( vm_a, "-9223372036854775808 -1 div OUT push", "DIV: Integer overflow!" );
+	check_error( vm_a, "-9223372036854775808 -1 mod OUT push", "MOD: Integer overflow!" );
+	check_error( vm_a, "nothere length OUT push", "LENGTH: Stack not found!" );
+	check_error( vm_a, "0 positive 1 call sync merge OUT push", "positive: Not a positive number!" );
+	
+	// Literals that don't fit an int64 fail to compile
+	check( compile_program( "99999999999999999999 OUT push", &error ) == NULL, "literal out of range" );
+	check( error == "Integer literal out of range!", "literal error message" );
+	
+	// Stacks only come from new_stack(), never from raw data
+	check( throws_raw( TYPE_STACK ), "raw stack" );
+	check( throws_raw( TYPE_SENTINEL ), "raw sentinel" );
+	check( !throws_raw( TYPE_INTEGER ), "raw integer" );
+	
+	check( vm_a->run( program, params, out, &error ), "run after error" );
+	check_result( out, factor_a, "result after error" );
+	
+	program->release();
+	delete vm_a;
+	delete vm_b;
+	
+	if( failures > 0 ){
+		return 1;
+		}
+	printf( "embed: ok\n" );
+	return 0;
+	}